@@ -31,6 +31,10 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Batch benchmark */
+#define BATCH_N      1000 /* blocks allocated and freed per round */
+#define BATCH_ROUNDS  100 /* rounds per timed run */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
@@ -73,6 +77,12 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Holds the params to eval_batch_speed */
+typedef struct {
+    size_t size;     /* payload size of every block */
+    int batch;       /* use the batch calls instead of one call per block? */
+} batch_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -125,6 +135,8 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_batch_speed(void *ptr);
+static void eval_batch(void);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
@@ -151,6 +163,10 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int hugepages = 0;   /* If set, back the heap with huge pages (-H) */
+    long sbrk_calls;     /* heap extensions made by the utilization run */
+    size_t huge_bytes;   /* heap bytes in huge pages after that run */
+    int run_batch = 0;   /* If set, benchmark the batch calls (-b) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -159,7 +175,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:m:hvVgalbHF")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -179,12 +195,25 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+	case 'm': /* Size of the heap to reserve, in megabytes */
+	    mem_set_heap_limit((size_t)atol(optarg) << 20);
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+	case 'F': /* Extend the heap by fixed-size chunks */
+	    mm_mallopt(MM_GROW_POLICY, MM_GROW_FIXED);
+	    break;
+	case 'H': /* Back the heap with transparent huge pages */
+	    hugepages = 1;
+	    mem_set_hugepages(1);
+	    break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+	case 'b': /* Benchmark the batch calls */
+	    run_batch = 1;
+	    break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -206,7 +235,8 @@ int main(int argc, char **argv)
     if (team_check) {
 	/* Students must fill in their team information */
 	if (!strcmp(team.teamname, "")) {
-	    printf("ERROR: Please provide the information about your team in mm.c.\n");
+	    printf("ERROR: Please provide the information about your team "
+		   "in mm.c.\n");
 	    exit(1);
 	} else
 	    printf("Team Name:%s\n", team.teamname);
@@ -219,7 +249,8 @@ int main(int argc, char **argv)
 
 	if (((*team.name2 != '\0') && (*team.id2 == '\0')) ||
 	    ((*team.name2 == '\0') && (*team.id2 != '\0'))) { 
-	    printf("ERROR.  You must fill in all or none of the team member 2 ID fields!\n");
+	    printf("ERROR.  You must fill in all or none of the team member 2 "
+		   "ID fields!\n");
 	    exit(1);
 	}
 	else if (*team.name2 != '\0')
@@ -299,11 +330,21 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("efficiency, ");
 	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    sbrk_calls = mem_sbrk_calls();
+	    huge_bytes = hugepages ? mem_anon_huge_bytes() : 0;
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+
+	    /* Report what the utilization run left behind */
+	    if (verbose)
+		printf("Trace %d: %ld calls to mem_sbrk that grew the heap.\n",
+		    i, sbrk_calls);
+	    if (hugepages)
+		printf("Trace %d: %zu KB of the heap in huge pages "
+		       "(AnonHugePages).\n", i, huge_bytes >> 10);
 	}
 	free_trace(trace);
     }
@@ -358,6 +399,9 @@ int main(int argc, char **argv)
 	printf("Terminated with %d errors\n", errors);
     }
 
+    if (run_batch)
+	eval_batch();
+
     if (autograder) {
 	printf("correct:%d\n", numcorrect);
 	printf("perfidx:%.0f\n", perfindex);
@@ -396,9 +440,10 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or a mapping */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_in_map(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -436,12 +481,10 @@ static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
     range_t **prevpp = ranges;
-    int size;
 
     for (p = *ranges;  p != NULL; p = p->next) {
         if (p->lo == lo) {
 	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
             free(p);
             break;
         }
@@ -690,10 +733,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   high water mark of the heap in bytes while running the student's
+ *   malloc package on the trace. Since mem_sbrk() lets the package
+ *   decrement the brk pointer, the final brk may be lower than that.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -779,7 +821,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
@@ -830,6 +872,68 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_batch_speed - This is the function that is used by fsecs()
+ *    to measure the running time of BATCH_ROUNDS rounds of allocating
+ *    and then freeing BATCH_N blocks, either one call per block or with
+ *    mm_malloc_batch and mm_free_batch.
+ */
+static void eval_batch_speed(void *ptr)
+{
+    static void *blocks[BATCH_N];
+    batch_t *params = (batch_t *)ptr;
+    int i, round;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_batch_speed");
+
+    for (round = 0; round < BATCH_ROUNDS; round++) {
+	if (params->batch) {
+	    if (mm_malloc_batch(params->size, BATCH_N, blocks) != BATCH_N)
+		app_error("mm_malloc_batch error in eval_batch_speed");
+	    mm_free_batch(blocks, BATCH_N);
+	} else {
+	    for (i = 0; i < BATCH_N; i++)
+		if ((blocks[i] = mm_malloc(params->size)) == NULL)
+		    app_error("mm_malloc error in eval_batch_speed");
+	    for (i = 0; i < BATCH_N; i++)
+		mm_free(blocks[i]);
+	}
+    }
+}
+
+/*
+ * eval_batch - Compare the throughput of the batch calls with that of
+ *    one mm_malloc and mm_free per block, for several block sizes.
+ *    Disables trimming, so it must run after the traces.
+ */
+static void eval_batch(void)
+{
+    static size_t sizes[] = {16, 64, 256, 1024, 4096};
+    batch_t params;
+    double ops, single, batch;
+    unsigned i;
+
+    /* Keep trims of the freed blocks out of both measurements */
+    mm_mallopt(MM_TRIM_THRESHOLD, SIZE_MAX);
+
+    ops = 2.0 * BATCH_N * BATCH_ROUNDS;
+    printf("\nBatch calls (%d blocks per batch):\n", BATCH_N);
+    printf("%8s%12s%12s\n", "size", "single", "batch");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+	params.size = sizes[i];
+	params.batch = 0;
+	single = fsecs(eval_batch_speed, &params);
+	params.batch = 1;
+	batch = fsecs(eval_batch_speed, &params);
+	printf("%8zu%12.0f%12.0f\n", sizes[i],
+	       ops / 1e3 / single, ops / 1e3 / batch);
+    }
+    printf("(Kops per second)\n");
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1011,13 +1115,19 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValbFH] [-f <file>] [-t <dir>] "
+	    "[-m <MB>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b         Benchmark the batch calls as well.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F         Extend the heap by fixed-size chunks.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Back the heap with transparent huge "
+	    "pages.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-m <MB>    Reserve a heap of <MB> megabytes.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
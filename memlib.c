@@ -2,8 +2,24 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * The heap is a range of virtual memory that mem_init reserves without
+ * access rights, so that no memory is committed to it.  mem_sbrk commits
+ * whole pages read/write as the brk advances past them, so a heap limit in
+ * the tens of gigabytes costs only address space.  As the brk retreats,
+ * up to MEM_SLACK bytes of committed pages are kept above it, so that a
+ * heap that shrinks and grows again by small steps does not decommit and
+ * refault the same pages each time.  Only the pages beyond that slack are
+ * decommitted.
+ *
+ * Optionally, the heap is backed by transparent huge pages.  The reserved
+ * range is then aligned to MEM_HUGEPAGE bytes and marked MADV_HUGEPAGE,
+ * and pages are committed in huge-page-sized steps so that the kernel can
+ * back each step with a single huge page.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
@@ -14,24 +30,70 @@
 #include "memlib.h"
 #include "config.h"
 
+#define MEM_HUGEPAGE (1 << 21)  /* size of a transparent huge page */
+#define MEM_SLACK    (1 << 21)  /* committed bytes kept above the brk */
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_commit_brk; /* end of the committed pages of the heap */
+static char *mem_zero_brk;   /* the heap is known to be zero from here */
+static size_t mem_limit = MAX_HEAP; /* size of the heap to reserve */
+static int mem_thp;          /* is the heap backed by huge pages? */
+static size_t mem_commit_unit; /* granularity of committing the heap */
+static long mem_nsbrk;       /* heap extensions since the last reset */
+
+/* mappings made outside the heap by mem_map */
+struct mem_mapping {
+    char *lo;                  /* first byte of the mapping */
+    size_t size;               /* size of the mapping in bytes */
+    struct mem_mapping *next;
+};
+static struct mem_mapping *mem_mappings; /* live mappings */
+static size_t mem_mapped;    /* total bytes in live mappings */
+static size_t mem_peak;      /* largest heap size plus mapped bytes */
+
+static void mem_update_peak(void);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    size_t align = mem_thp ? MEM_HUGEPAGE : mem_pagesize();
+    size_t limit = (mem_limit + align - 1) & ~(align - 1);
+    char *p, *start;
+
+    /*
+     * reserve the address space we will use to model the available VM,
+     * aligned for huge pages if they are wanted
+     */
+    p = mmap(NULL, limit + align, PROT_NONE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
+    start = (char *)(((uintptr_t)p + align - 1) & ~(align - 1));
+    if (start > p)
+	munmap(p, start - p);
+    munmap(start + limit, p + align - start);
+    mem_start_brk = start;
+    mem_commit_unit = mem_pagesize();
+    if (mem_thp) {
+	if (madvise(start, limit, MADV_HUGEPAGE) == 0)
+	    mem_commit_unit = MEM_HUGEPAGE;
+	else
+	    mem_thp = 0;
+    }
+    mem_limit = limit;
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    mem_max_addr = mem_start_brk + mem_limit; /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_commit_brk = mem_start_brk;           /* nothing is committed */
+    mem_zero_brk = mem_start_brk;             /* nothing has been used */
+    mem_peak = 0;
 }
 
 /* 
@@ -39,35 +101,271 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_start_brk, mem_max_addr - mem_start_brk);
+}
+
+/*
+ * mem_set_heap_limit - set the size of the heap that the next call to
+ *    mem_init reserves, rounded up to a whole number of pages
+ */
+void mem_set_heap_limit(size_t limit)
+{
+    size_t page = mem_pagesize();
+
+    mem_limit = (limit + page - 1) & ~(page - 1);
+}
+
+/*
+ * mem_set_hugepages - if enable is nonzero, ask the next call to
+ *    mem_init to back the heap with transparent huge pages
+ */
+void mem_set_hugepages(int enable)
+{
+    mem_thp = enable;
+}
+
+/*
+ * mem_hugepage_size - returns the size of the huge pages backing the
+ *    heap, or 0 if the heap is not backed by huge pages
+ */
+size_t mem_hugepage_size()
+{
+    return mem_thp ? MEM_HUGEPAGE : 0;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_anon_huge_bytes - returns the number of bytes of the heap that
+ *    the kernel reports as backed by anonymous huge pages, or 0 if that
+ *    cannot be determined
+ */
+size_t mem_anon_huge_bytes()
+{
+    char line[256];
+    uintptr_t lo, hi;
+    size_t kb, total = 0;
+    int in_heap = 0;
+    FILE *fp;
+
+    if ((fp = fopen("/proc/self/smaps", "r")) == NULL)
+	return 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2)
+	    in_heap = (char *)lo < mem_max_addr && (char *)hi > mem_start_brk;
+	else if (in_heap && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+	    total += kb * 1024;
+    }
+    fclose(fp);
+    return total;
+}
+
+/*
+ * mem_sbrk_calls - returns the number of successful calls to mem_sbrk
+ *    that grew the heap since the heap was last reset
+ */
+long mem_sbrk_calls()
+{
+    return mem_nsbrk;
+}
+
+/*
+ * mem_zero_lo - returns the address from which the heap is known to be
+ *    zero: no memory at or above it has been returned by mem_sbrk since
+ *    its pages were last decommitted, or since mem_init
+ */
+void *mem_zero_lo()
+{
+    return (void *)mem_zero_brk;
+}
+
+/*
+ * mem_heap_limit - returns the largest size of the heap in bytes
+ */
+size_t mem_heap_limit()
+{
+    return (size_t)(mem_max_addr - mem_start_brk);
+}
+
+/*
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap.
+ *    The memory that was in use is not cleared, so it is no longer known
+ *    to be zero.
  */
 void mem_reset_brk()
 {
+    struct mem_mapping *m;
+
     mem_brk = mem_start_brk;
+
+    /* an empty memory system has no mappings either */
+    while ((m = mem_mappings) != NULL) {
+	mem_mappings = m->next;
+	munmap(m->lo, m->size);
+	free(m);
+    }
+    mem_mapped = 0;
+    mem_peak = 0;
+    mem_nsbrk = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area.
+ *    A negative incr shrinks the heap, and the whole pages that are
+ *    given back are decommitted, except for MEM_SLACK bytes of them
+ *    above the new brk.
  */
 void *mem_sbrk(intptr_t incr) 
 {
     char *old_brk = mem_brk;
+    uintptr_t page = mem_commit_unit;
+    char *commit;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if (incr < 0) {
+	if (-incr > mem_brk - mem_start_brk) {
+	    errno = EINVAL;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Heap underflow...\n");
+	    return (void *)-1;
+	}
+	mem_brk += incr;
+	commit = (char *)(((uintptr_t)mem_brk + page - 1) & ~(page - 1));
+	if (mem_commit_brk - commit > MEM_SLACK) {
+	    commit += MEM_SLACK;
+	    madvise(commit, mem_commit_brk - commit, MADV_DONTNEED);
+	    mprotect(commit, mem_commit_brk - commit, PROT_NONE);
+	    mem_commit_brk = commit;
+	    if (commit < mem_zero_brk)
+		mem_zero_brk = commit;
+	}
+	return (void *)old_brk;
+    }
+    if ((mem_brk + incr) > mem_max_addr) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
+
+    /* commit the pages that the new area reaches into */
+    commit = (char *)(((uintptr_t)mem_brk + incr + page - 1) & ~(page - 1));
+    if (commit > mem_commit_brk) {
+	if (mprotect(mem_commit_brk, commit - mem_commit_brk,
+		     PROT_READ | PROT_WRITE) < 0) {
+	    errno = ENOMEM;
+	    fprintf(stderr,
+		    "ERROR: mem_sbrk failed. Cannot commit memory...\n");
+	    return (void *)-1;
+	}
+	mem_commit_brk = commit;
+    }
     mem_brk += incr;
+    if (incr > 0)
+	mem_nsbrk++;
+    if (mem_brk > mem_zero_brk)
+	mem_zero_brk = mem_brk;
+    mem_update_peak();
     return (void *)old_brk;
 }
 
+/*
+ * mem_map - maps size bytes of zeroed memory outside the heap and
+ *    returns its start address, or (void *)-1 on failure
+ */
+void *mem_map(size_t size)
+{
+    struct mem_mapping *m;
+    void *p;
+
+    if ((m = malloc(sizeof(*m))) == NULL) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+	     -1, 0);
+    if (p == MAP_FAILED) {
+	free(m);
+	return (void *)-1;
+    }
+    m->lo = p;
+    m->size = size;
+    m->next = mem_mappings;
+    mem_mappings = m;
+    mem_mapped += size;
+    mem_update_peak();
+    return p;
+}
+
+/*
+ * mem_unmap - unmaps a whole mapping made by mem_map; returns 0 on
+ *    success and -1 if p is not the start of a mapping
+ */
+int mem_unmap(void *p)
+{
+    struct mem_mapping **mp, *m;
+
+    for (mp = &mem_mappings; (m = *mp) != NULL; mp = &m->next) {
+	if (m->lo == p) {
+	    *mp = m->next;
+	    mem_mapped -= m->size;
+	    munmap(m->lo, m->size);
+	    free(m);
+	    return 0;
+	}
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+/*
+ * mem_remap - resizes a mapping made by mem_map to size bytes, moving
+ *    it if necessary; returns its new start address, or (void *)-1 on
+ *    failure, in which case the mapping is unchanged
+ */
+void *mem_remap(void *p, size_t size)
+{
+    struct mem_mapping *m;
+    void *q;
+
+    for (m = mem_mappings; m != NULL && m->lo != p; m = m->next)
+	;
+    if (m == NULL) {
+	errno = EINVAL;
+	return (void *)-1;
+    }
+    q = mremap(m->lo, m->size, size, MREMAP_MAYMOVE);
+    if (q == MAP_FAILED)
+	return (void *)-1;
+    mem_mapped = mem_mapped - m->size + size;
+    m->lo = q;
+    m->size = size;
+    mem_update_peak();
+    return q;
+}
+
+/*
+ * mem_in_map - returns 1 if the bytes lo through hi lie within a
+ *    single mapping made by mem_map, and 0 otherwise
+ */
+int mem_in_map(void *lo, void *hi)
+{
+    struct mem_mapping *m;
+
+    for (m = mem_mappings; m != NULL; m = m->next)
+	if ((char *)lo >= m->lo && (char *)hi < m->lo + m->size)
+	    return 1;
+    return 0;
+}
+
+/*
+ * mem_update_peak - records the current heap size plus mapped bytes
+ *    if that is a new peak
+ */
+static void mem_update_peak(void)
+{
+    size_t size = (size_t)(mem_brk - mem_start_brk) + mem_mapped;
+
+    if (size > mem_peak)
+	mem_peak = size;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -92,6 +390,16 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_peak_heapsize() - returns the largest amount of memory in bytes,
+ *    counting both the heap and the mappings made by mem_map, since the
+ *    heap was last reset
+ */
+size_t mem_peak_heapsize()
+{
+    return mem_peak;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
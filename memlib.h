@@ -1,8 +1,20 @@
 void mem_init(void);               
 void mem_deinit(void);
+void mem_set_heap_limit(size_t limit);
+size_t mem_heap_limit(void);
+void mem_set_hugepages(int enable);
+size_t mem_hugepage_size(void);
+size_t mem_anon_huge_bytes(void);
 void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
+void *mem_map(size_t size);
+int mem_unmap(void *p);
+void *mem_remap(void *p, size_t size);
+int mem_in_map(void *lo, void *hi);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+long mem_sbrk_calls(void);
+void *mem_zero_lo(void);
 size_t mem_pagesize(void);
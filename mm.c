@@ -1,23 +1,185 @@
-/* 
- * Simple, 32-bit and 64-bit clean allocator based on an implicit free list,
- * first fit placement, and boundary tag coalescing, as described in the
- * CS:APP2e text.  Blocks are aligned to double-word boundaries.  This
- * yields 8-byte aligned blocks on a 32-bit processor, and 16-byte aligned
- * blocks on a 64-bit processor.  However, 16-byte alignment is stricter
- * than necessary; the assignment only requires 8-byte alignment.  The
- * minimum block size is four words.
+/*
+ * Simple, 32-bit and 64-bit clean allocator based on segregated explicit
+ * free lists, good fit placement, and boundary tag coalescing, as described
+ * in the CS:APP2e text.  Blocks are aligned to ASIZE-byte boundaries.
+ * Every block has a 4-byte header holding its size, its allocated bit,
+ * and the allocated bit of the block before it.  Only free blocks have a
+ * footer, since coalescing only ever reads the footer of a free previous
+ * block, so an allocated block carries just four bytes of overhead.  A
+ * free block stores its next and previous links in its payload in addition
+ * to its header and footer.  The links are 4-byte offsets from the start
+ * of the heap in ASIZE-byte units rather than pointers, so the minimum
+ * block size is only 16 bytes.  A header stores the size in ASIZE-byte
+ * granules above its two flag bits, so a single block can be almost 8 GiB,
+ * and the 32-bit links can address a heap of up to 32 GiB.  A region never
+ * grows past the largest block, so no coalesced block can outgrow its
+ * header.
+ *
+ * Free blocks are indexed by a two-level segregated fit (TLSF) scheme.  The
+ * first level divides block sizes into power-of-two ranges and the second
+ * level divides each range into SL_COUNT equal subranges, each with its own
+ * doubly-linked, NULL-terminated free list.  Blocks smaller than SMALL_BLOCK
+ * have exact size classes.  A bitmap over the first level and one bitmap
+ * per first-level range over the second level record which lists are
+ * non-empty, so a suitable list is found with two find-first-set
+ * operations instead of a search.  A request is rounded up to the next
+ * subrange boundary before the lookup, so every block in the list found is
+ * large enough, and mm_malloc and mm_free take bounded time regardless of
+ * the number of free blocks.
+ *
+ * Free blocks of at least TREE_MIN bytes are instead kept in an AVL tree
+ * ordered by size and then by address, whose nodes are stored in the free
+ * blocks themselves.  A request for a large block descends the tree once
+ * to find the smallest block that is large enough, taking the block at the
+ * lowest address among blocks of that size, so large requests get a best
+ * fit in logarithmic time.  Insertion and removal walk down the tree
+ * once, keeping the path on a stack, and rebalance back up it only until
+ * a subtree's height stops changing.  Each node caches its block's size,
+ * so that comparisons do not reread headers.  The segregated lists stay
+ * in front of the tree up to TREE_MIN, 64 KiB, since their second-level
+ * classes already fit within 1/SL_COUNT of the request, and a tree
+ * operation on blocks spread over many pages costs several times a list
+ * operation.
+ *
+ * Coalescing of blocks of at most QUICK_MAX bytes is deferred.  Such a
+ * block is pushed onto its arena's quick list for its exact size when it
+ * is freed, staying allocated as far as the rest of the heap is concerned,
+ * and a request of the same size pops it again.  The quick lists are
+ * flushed through the normal free path only when no free block fits a
+ * request, before the heap is extended.
+ *
+ * The free block that ends an arena's last region is the arena's
+ * wilderness.  It is kept out of the free lists and the tree, and a request
+ * is carved from its start only when no other free block fits, so the
+ * wilderness is preserved for requests that need it.  Carving needs no list
+ * manipulation: the remainder simply becomes the new wilderness.  An arena
+ * also tracks the address from which its wilderness has never been used
+ * since memlib obtained it, so that mm_calloc need not clear that memory.
+ *
+ * The heap gives memory back when it can.  When a free leaves a free block
+ * of at least the trim threshold at the end of the heap, all but a top pad
+ * of it are returned to memlib by shrinking the brk, and mm_trim does the
+ * same on demand.  The top pad is the larger of TRIM_PAD and the arena's
+ * next extension, so that a burst of allocations that follows a trim does
+ * not immediately grow the heap again.  A trim keeps exactly the pad,
+ * since memlib decommits only whole pages anyway, but is skipped unless it
+ * releases at least a page.  When memlib backs the heap with transparent
+ * huge pages, the heap grows a whole huge page at a time, so that each
+ * step can be backed by one huge page.
+ *
+ * The heap is extended adaptively.  Each time an arena runs out of free
+ * memory soon after it last did, its next extension is doubled, up to a
+ * cap that scales with the size of the heap, and it is halved again when
+ * growth slows down.  Small programs therefore still grow CHUNKSIZE bytes
+ * at a time, while allocation-heavy ones make few calls to mem_sbrk.
+ * mm_mallopt can restore the fixed policy.
+ *
+ * Requests of at least the mmap threshold bypass the arenas altogether.
+ * Each such block is a separate mapping obtained from memlib's mem_map
+ * that begins with the mapping's size, followed by the block, which has no
+ * header.  Any block outside the heap's address range is such a mapping,
+ * so mm_free unmaps it and mm_realloc resizes it with mem_remap.
+ *
+ * Requests of at most SLAB_MAX bytes are instead served by a small-object
+ * allocator.  Each size class of SLAB_MAX / ASIZE classes owns a list of
+ * runs, where a run is a page-aligned, RUNSIZE-byte allocated block that is
+ * carved into equal slots.  A run begins with a struct run that holds a
+ * bitmap of the slots in use, so slots have no header of their own.  The
+ * pages that hold runs are marked, so that mm_free can tell a slot from a
+ * block and find a slot's run by rounding its address down to the page.
+ * Runs are carved out of free blocks at page boundaries, and mm_memalign
+ * carves blocks at any other power-of-two alignment the same way, returning
+ * the space before the block to the free lists.  A block is carved from
+ * the first free block or wilderness that holds it once aligned, and the
+ * heap is extended by just enough to align it at the end, so alignment
+ * costs no more than the leading free block.
+ *
+ * mm_free_sized and mm_realloc_sized take the size of the original
+ * request, which determines the block's size class, so a cached free
+ * reads neither the block's header nor, unless the size is a slot's, its
+ * page.  A block from mm_memalign is never a slot, so a slot-sized free
+ * checks the page and frees any other block through its header.  A free
+ * that is too large for the quick lists goes straight to coalescing.
+ * Compiling with -DMM_DEBUG checks each such size against the block.
+ *
+ * A bump arena (struct mm_arena) serves memory that dies all at once.  It
+ * takes large chunks from mm_malloc and allocates from the current one by
+ * advancing a pointer.  mm_arena_reset frees everything allocated from it
+ * in time proportional to the number of chunks, keeping the current chunk.
+ *
+ * A pool (struct mm_pool) serves objects of one fixed size.  It carves
+ * slabs, which are blocks aligned to their size, into objects, so that
+ * mm_pool_free finds an object's slab by rounding its address down.  Each
+ * slab keeps a LIFO list of its freed objects, and an empty slab is
+ * returned to the heap.
+ *
+ * mm_maint_start starts an optional maintenance thread that does deferred
+ * work off the callers' path.  Periodically, it completes remote frees,
+ * coalesces the quick lists of idle arenas, and trims the heap, taking
+ * only arena locks that are free.  While it runs, mm_free does not trim.
+ *
+ * A block allocated with mm_halloc is reached through a handle, and its
+ * address is only fixed while the handle is locked.  mm_compact slides the
+ * blocks of unlocked handles toward the start of their region, so the free
+ * space around them merges into fewer, larger blocks and the heap's free
+ * tail can be trimmed.  Every other block stays where it is.
+ *
+ * mm_malloc_batch carves a whole batch of equal blocks out of a single free
+ * block, updating the free lists once, and mm_free_batch sorts the blocks
+ * it is given by address, so that adjacent blocks are merged and inserted
+ * into the free lists as one.
+ *
+ * All of the above is kept per arena.  The heap is divided among up to
+ * NARENAS_MAX arenas, one per processor, and each thread is assigned to an
+ * arena round-robin the first time it allocates.  An arena has its own
+ * lock, free list index, and runs, and owns one or more regions of the
+ * heap.  A region is a contiguous part of the memlib heap with its own
+ * prologue and epilogue.  An arena grows its last region in place while
+ * that region ends the heap, and otherwise starts a new region on a fresh
+ * page, so every page of the heap belongs to exactly one arena.  A byte
+ * per page records the page's arena and whether the page holds a run, so
+ * mm_free returns a block to the arena that owns it, under that arena's
+ * lock.  Threads that share an arena contend only with each other.
  *
- * This allocator uses the size of a pointer, e.g., sizeof(void *), to
- * define the size of a word.  This allocator also uses the standard
- * type uintptr_t to define unsigned integers that are the same size
- * as a pointer, i.e., sizeof(uintptr_t) == sizeof(void *).
+ * Arenas cost some utilization.  Free memory in one arena cannot serve
+ * another arena's requests, a region that is not the first one is at
+ * least REGIONSIZE bytes, and the start of each region is padded to a
+ * page.  Runs cost some more: a run holds a whole page as long as one of
+ * its slots is in use, and each size class keeps one empty run.
+ *
+ * A block freed by a thread that does not use the owning arena is not
+ * freed under that arena's lock.  Instead, it is pushed onto the arena's
+ * lock-free stack of remote frees, and the next mm_malloc from the arena
+ * takes the whole stack at once and frees its blocks under the lock it
+ * already holds.
+ *
+ * In front of the arenas, each thread keeps a small cache of the blocks
+ * and slots it recently freed, with one LIFO list per size up to
+ * TCACHE_MAX bytes.  Cached blocks stay allocated as far as their arena is
+ * concerned, so a thread can take one back out of its cache or put one in
+ * without taking a lock.  Since a cached block cannot coalesce, a cache
+ * holds at most TCACHE_BYTES bytes, and a block next to a free block is
+ * freed to its arena at once instead of being cached.  mm_init starts a
+ * new heap generation, which invalidates every thread's cache, and a
+ * thread's cache is returned to the arenas when the thread exits.
+ *
+ * This allocator uses the standard type uint32_t for headers and footers,
+ * and the standard type uintptr_t to define unsigned integers that are
+ * the same size as a pointer, i.e., sizeof(uintptr_t) == sizeof(void *).
  */
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
 
+#include "config.h"
 #include "memlib.h"
 #include "mm.h"
 
@@ -40,75 +202,417 @@ team_t team = {
 
 /* Basic constants and macros: */
 #define ASIZE	   8		  	  /* Number of bytes to align to */
-#define WSIZE      sizeof(void *) /* Word and header/footer size (bytes) */
+#define WSIZE      4              /* Word and header/footer size (bytes) */
 #define DSIZE      (2 * WSIZE)    /* Doubleword size (bytes) */
 #define QSIZE	   (4 * WSIZE)	  /* Quadword size (bytes) */
 #define CHUNKSIZE  (1 << 12)      /* Extend heap by this amount (bytes) */
+#define REGIONSIZE (1 << 16)      /* Minimum size of a later region (bytes) */
+
+#define ASIZE_LOG2 3              /* log2(ASIZE) */
+#define SL_SHIFT   5              /* log2(SL_COUNT) */
+#define SL_COUNT   (1 << SL_SHIFT)  /* Second-level lists per first level */
+#define FL_SHIFT   (SL_SHIFT + ASIZE_LOG2)
+#define SMALL_BLOCK (1 << FL_SHIFT) /* Blocks below this have exact classes */
+#define FL_MAX     33             /* log2 of the block size limit */
+#define BLOCK_MAX  (((size_t)1 << FL_MAX) - ASIZE)  /* Largest block */
+#define HEAP_MAX   ((size_t)1 << (32 + ASIZE_LOG2))  /* Largest heap */
+#define TREE_SHIFT 16             /* log2(TREE_MIN) */
+#define TREE_MIN   (1 << TREE_SHIFT)  /* Smallest free block in the tree */
+#define TREE_DEPTH 64             /* Largest height of the tree */
+#define FL_COUNT   (TREE_SHIFT - FL_SHIFT + 1)  /* First-level ranges */
+
+#define SLAB_MAX   64             /* Largest request served from a run */
+#define SLAB_CLASSES (SLAB_MAX / ASIZE)  /* Small-object size classes */
+#define RUN_SHIFT  12             /* log2(RUNSIZE) */
+#define RUNSIZE    (1 << RUN_SHIFT) /* Size and alignment of a run (bytes) */
+#define RUN_WORDS  (RUNSIZE / ASIZE / 64)  /* Words in a run's slot bitmap */
+
+#define NARENAS_MAX 64            /* Largest number of arenas */
+#define CACHELINE  64             /* Alignment of an arena (bytes) */
+
+#define TCACHE_MAX 512            /* Largest block or slot cached (bytes) */
+#define TCACHE_COUNT 7            /* Blocks cached per size */
+#define TCACHE_BYTES (1 << 13)    /* Most bytes cached per thread */
+
+#define QUICK_MAX  512            /* Largest block on a quick list (bytes) */
+
+#define TRIM_THRESHOLD (1 << 17)  /* Default free tail that is trimmed */
+#define TRIM_PAD   (1 << 17)      /* Least free tail kept by a trim */
+
+#define MMAP_THRESHOLD (1 << 20)  /* Default smallest mapped request */
+
+#define GROW_MAX   (1 << 20)      /* Largest adaptive heap extension */
+#define GROW_RATIO 16             /* Heap size / largest adaptive extension */
+#define GROW_DECAY 256            /* Allocations that mark slow growth */
+
+#define BUMP_CHUNK (1 << 16)      /* Default bump arena chunk (bytes) */
+
+#define POOL_SLAB  (1 << 14)      /* Smallest pool slab (bytes) */
+#define POOL_MIN_OBJS 8           /* Fewest objects in a pool slab */
+#define POOL_MAX   (1 << 20)      /* Largest pool object or alignment */
+
+#define HANDLE_CHUNK (1 << 16)    /* Memory mapped for handles at a time */
+
+#define MAINT_PERIOD 100          /* Default maintenance period (ms) */
 
-#define MAX(x, y)  ((x) > (y) ? (x) : (y))  
+#define MAX(x, y)  ((x) > (y) ? (x) : (y))
 
-/* Pack a size and allocated bit into a word. */
-#define PACK(size, alloc)  ((size) | (alloc))
+/* Flag bits in a header. */
+#define ALLOC      0x1            /* This block is allocated */
+#define PREV_ALLOC 0x2            /* The previous block is allocated */
+#define FLAG_BITS  2              /* Low header bits holding the flags */
 
-/* Read and write a word at address p. */
-#define GET(p)       (*(uintptr_t *)(p))
-#define PUT(p, val)  (*(uintptr_t *)(p) = (val))
+/*
+ * Pack a size and allocated bits into a word.  The size is stored in
+ * ASIZE-byte granules above the flag bits.
+ */
+#define PACK(size, alloc)  \
+	((uint32_t)((size) >> ASIZE_LOG2 << FLAG_BITS) | (alloc))
+
+/*
+ * Read and write a word at address p.  mm_free, mm_realloc, and the thread
+ * caches read headers without the owning arena's lock, even for blocks of
+ * other arenas, while the arena rewrites them under its lock, so every
+ * access is a relaxed atomic.  Only threads holding the arena's lock
+ * write its headers, so a read followed by a write is not torn.
+ */
+#define GET(p)       __atomic_load_n((uint32_t *)(p), __ATOMIC_RELAXED)
+#define PUT(p, val)  \
+	__atomic_store_n((uint32_t *)(p), (uint32_t)(val), __ATOMIC_RELAXED)
 
 /* Read the size and allocated fields from address p. */
-#define GET_SIZE(p)   (GET(p) & ~(ASIZE - 1))
-#define GET_ALLOC(p)  (GET(p) & 0x1)
+#define GET_SIZE(p)   ((size_t)(GET(p) >> FLAG_BITS) << ASIZE_LOG2)
+#define GET_ALLOC(p)  (GET(p) & ALLOC)
+#define GET_PREV_ALLOC(p)  (GET(p) & PREV_ALLOC)
+
+/* Set or clear the previous block's allocated bit in the header at p. */
+#define SET_PREV_ALLOC(p)    PUT(p, GET(p) | PREV_ALLOC)
+#define CLEAR_PREV_ALLOC(p)  PUT(p, GET(p) & ~(uint32_t)PREV_ALLOC)
 
-/* Given block ptr bp, compute address of its header and footer. */
+/* Given block ptr bp, compute address of its header and free block footer. */
 #define HDRP(bp)  ((char *)(bp) - WSIZE)
 #define FTRP(bp)  ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks. */
-#define NEXT_BLKP(bp) ((char *)(GET((char *)(HDRP(bp) +  WSIZE))))
-#define PREV_BLKP(bp) ((char *)(GET((char *)(HDRP(bp) + 2 * WSIZE))))
-
-#define NEXT_PHYS_BLKP(bp) ((char *)(FTRP(bp) + 2 * WSIZE))
-#define PREV_PHYS_BLKP(bp) ((char *)(bp - (GET_SIZE(bp - 2 * WSIZE))))
-
-/* Given block ptr bp, put a pointer into it to the next block in list. */
-#define SET_NEXT(bp, bp2) (PUT(bp, (uint64_t)bp2))
+/*
+ * Given block ptr bp, compute address of next and previous blocks.  The
+ * previous block can only be found if it is free.
+ */
+#define NEXT_PHYS_BLKP(bp)  ((char *)(bp) + GET_SIZE(HDRP(bp)))
+#define PREV_PHYS_BLKP(bp)  ((char *)(bp) - GET_SIZE((char *)(bp) - DSIZE))
 
-/* Given block ptr bp, put pointer in adjacent block to the previous block */
-#define SET_PREV(bp, bp2) (PUT(bp + WSIZE, (uint64_t)bp2))
+/*
+ * The free list links stored in the payload of a free block, as offsets
+ * from heap_base in ASIZE-byte units.  Offset 0 is the start of the first
+ * region, which is never a block, so it stands for NULL.
+ */
+struct fnode {
+	uint32_t next;
+	uint32_t previous;
+};
 
-/* Given bin number, compute distance from heap_listp to bin*/
-#define BIN_DIST(num) ((num + 1) * WSIZE)
+/* Convert between a free block and its offset from heap_base. */
+#define BLK_OFF(bp)   ((uint32_t)(((char *)(bp) - heap_base) / ASIZE))
+#define OFF_BLK(off)  ((off) == 0 ? NULL :				\
+	(struct fnode *)(heap_base + (size_t)(off) * ASIZE))
 
+/* The link stored in a block on a quick list, thread cache, or stack. */
 struct node {
 	struct node *next;
-	struct node *previous;
 };
 
+/* The tree links stored in the payload of a free block in the tree. */
+struct tnode {
+	struct tnode *left;      /* Smaller blocks */
+	struct tnode *right;     /* Larger blocks */
+	size_t size;             /* The block's size, cached from its header */
+	int height;              /* Height of the subtree rooted here */
+};
+
+/*
+ * The metadata at the start of a run, which is the payload of the heap
+ * block that holds the run.  The slots follow the bitmap.
+ */
+struct run {
+	struct run *next;        /* Next run in the class with a free slot */
+	struct run *previous;    /* Previous such run in the class */
+	uint32_t size;           /* Slot size (bytes) */
+	uint32_t nfree;          /* Number of free slots */
+	uint64_t used[RUN_WORDS]; /* Bitmap of the slots in use */
+};
+
+/*
+ * The start of a region of the heap.  The region's prologue block follows,
+ * then its blocks, and the region ends with an epilogue header.
+ */
+struct region {
+	struct region *next;     /* The next region, in address order */
+	uint32_t pad;            /* Aligns the prologue block's payload */
+	uint32_t prologue;       /* The prologue block's header */
+};
+
+/*
+ * An independent heap with its own lock, free list index, and runs.
+ * Arenas are aligned to a cache line so that threads using different
+ * arenas do not share one.
+ */
+struct arena {
+	pthread_mutex_t lock;    /* Protects everything below */
+	uint32_t fl_bitmap;                         /* Non-empty fl ranges */
+	uint32_t sl_bitmap[FL_COUNT];               /* Non-empty sl lists */
+	struct fnode *seg_heads[FL_COUNT][SL_COUNT]; /* Free list heads */
+	struct tnode *tree;      /* The root of the tree of large blocks */
+	struct run *runs[SLAB_CLASSES];  /* Runs with a free slot */
+	struct node *quick[QUICK_MAX / ASIZE + 1];  /* Quick lists by size */
+	size_t nquick;           /* Number of blocks on the quick lists */
+	char *top;               /* The last region's epilogue block, or NULL */
+	void *wild;              /* The free block before top, or NULL */
+	char *clean;             /* The wilderness is zero from here on */
+	size_t grow;             /* The size of the last heap extension */
+	unsigned long nalloc;    /* Allocations from the free lists */
+	unsigned long grow_mark; /* The value of nalloc at the last extension */
+
+	/* Blocks freed by other threads, pushed without the lock. */
+	struct node *remote __attribute__((aligned(CACHELINE)));
+} __attribute__((aligned(CACHELINE)));
+
+/* A thread's cache of freed blocks and slots, indexed by size / ASIZE. */
+struct tcache {
+	unsigned long gen;       /* The heap generation of the cached blocks */
+	bool registered;         /* Is the cache flushed at thread exit? */
+	struct node *heads[TCACHE_MAX / ASIZE + 1];  /* Singly-linked lists */
+	uint8_t counts[TCACHE_MAX / ASIZE + 1];      /* List lengths */
+	size_t bytes;            /* Total size of the cached blocks */
+};
+
+/*
+ * A chunk of a bump arena, allocated with mm_malloc.  Its memory follows
+ * the header.
+ */
+struct bump_chunk {
+	struct bump_chunk *next; /* The next older chunk */
+	size_t size;             /* Bytes of memory after the header */
+};
+
+/*
+ * A bump arena, which allocates by advancing a pointer through its current
+ * chunk and frees all of its memory at once.  It is unrelated to the
+ * arenas that divide the heap.
+ */
+struct mm_arena {
+	struct bump_chunk *chunks;  /* All chunks, newest first */
+	struct bump_chunk *current; /* The chunk being bumped, or NULL */
+	char *ptr;               /* The next free byte of the current chunk */
+	char *end;               /* The end of the current chunk */
+	size_t chunk_size;       /* The memory in a new current chunk */
+};
+
+/* Given a bump chunk, compute the address of its memory. */
+#define CHUNK_MEM(chunk)  ((char *)((chunk) + 1))
+
+/*
+ * The start of a pool slab, which is a block aligned to its size that is
+ * carved into a pool's objects.  The objects follow, starting at the
+ * pool's offset.
+ */
+struct pool_slab {
+	struct pool_slab *next;     /* Next slab on the same list */
+	struct pool_slab *previous; /* Previous slab on the same list */
+	struct node *free;       /* Freed objects */
+	char *bump;              /* The first object never allocated */
+	uint32_t nfree;          /* Free objects, including never allocated */
+};
+
+/* A pool of fixed-size objects. */
+struct mm_pool {
+	struct pool_slab *partial;  /* Slabs with a free object */
+	struct pool_slab *full;  /* Slabs without a free object */
+	size_t size;             /* The size of an aligned object */
+	size_t slab_size;        /* The size and alignment of a slab */
+	size_t offset;           /* The offset of a slab's first object */
+	uint32_t nobjs;          /* Objects per slab */
+};
+
+/*
+ * A handle to a relocatable block.  mm_compact may move the block while
+ * the handle is not locked.  Handles are kept outside the heap, so that
+ * they do not pin the blocks around them.
+ */
+struct mm_handle {
+	void *ptr;               /* The block */
+	unsigned int locks;      /* Outstanding mm_hlock calls */
+	struct mm_handle *next;  /* Next handle */
+	struct mm_handle *previous;  /* Previous handle */
+};
+
+/* Given an object of a pool, compute the address of its slab. */
+#define POOL_SLABP(pool, p)  ((struct pool_slab *)			\
+	((uintptr_t)(p) & ~(uintptr_t)((pool)->slab_size - 1)))
+
+/* The bits of a page's entry in the page map. */
+#define PAGE_RUN    0x80          /* The page holds a run */
+#define PAGE_ARENA  0x7f          /* The index of the page's arena */
+
+/*
+ * Read and write entry "n" of the page map.  Threads read entries without
+ * any lock to find a block's arena, while the arena that owns the page
+ * rewrites its entry under its lock, so every access is a relaxed atomic.
+ */
+#define PAGE_GET(n)       __atomic_load_n(&page_map[n], __ATOMIC_RELAXED)
+#define PAGE_PUT(n, val)  \
+	__atomic_store_n(&page_map[n], (uint8_t)(val), __ATOMIC_RELAXED)
+
+/* Given a slot, compute the address of its run and test for a run page. */
+#define RUNP(p)     ((struct run *)((uintptr_t)(p) & ~(uintptr_t)(RUNSIZE - 1)))
+#define PAGE_NUM(p) (((uintptr_t)(p) >> RUN_SHIFT) - heap_page)
+#define IS_RUN(p)   ((PAGE_GET(PAGE_NUM(p)) & PAGE_RUN) != 0)
+
+/* Given a block or slot, compute the address of the arena that owns it. */
+#define OWNER(p)    (&arenas[PAGE_GET(PAGE_NUM(p)) & PAGE_ARENA])
+
+/* Test whether a block or slot lies in the heap rather than a mapping. */
+#define IS_HEAP(p)  (PAGE_NUM(p) < page_map_size)
+
+/* Given a run, compute the address of its first slot and its slot count. */
+#define RUN_SLOTP(run)  ((char *)(run) + sizeof(struct run))
+#define RUN_NSLOTS(run) \
+	((uint32_t)((RUNSIZE - WSIZE - sizeof(struct run)) / (run)->size))
+
+/* Given a region, compute the address of its prologue block. */
+#define REGION_PROLOGUE(region)  ((char *)((region) + 1))
+
+/*
+ * A huge block's mapping begins with the mapping's size, and the block
+ * starts HUGE_HDR bytes into the mapping.
+ */
+#define HUGE_HDR   ASIZE
+#define HUGE_SIZE(bp)  (*(size_t *)((char *)(bp) - HUGE_HDR))
+
 /* Global variables: */
-static char *heap_listp; /* Pointer to first block */
-//static int binNum = 12;
-//char *list_start;
-static struct node *list_start;
+static struct arena arenas[NARENAS_MAX];   /* The arenas */
+static int narenas;                         /* Number of arenas in use */
+static unsigned int next_arena;             /* Next arena to assign */
+static __thread struct arena *thread_arena; /* This thread's arena */
+
+/* The regions of the heap, protected by sbrk_lock along with memlib. */
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct region *regions;             /* The first region */
+static struct region *last_region;         /* The region that ends the heap */
+static uint8_t *page_map;                  /* Each page's arena and run bit */
+static size_t page_map_size;               /* Pages in the largest heap */
+static uintptr_t heap_page;                /* Page number of the heap start */
+static char *heap_base;                    /* The start of the heap */
+
+/* The handles, protected by handle_lock. */
+static pthread_mutex_t handle_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mm_handle *handles;          /* All handles in use */
+static struct mm_handle *free_handles;     /* Unused handles */
+
+/* The per-thread caches. */
+static unsigned long heap_gen;              /* Incremented by mm_init */
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;            /* Flushes a cache at exit */
+static __thread struct tcache tcache;       /* This thread's cache */
+
+/* The maintenance thread, controlled under maint_lock. */
+static pthread_mutex_t maint_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maint_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t maint_thread;              /* The thread, if running */
+static bool maint_running;                  /* Is the thread running? */
+static unsigned int maint_period;           /* Time between passes (ms) */
+
+/* Parameters set by mm_mallopt. */
+static size_t trim_threshold = TRIM_THRESHOLD; /* Free tail that is trimmed */
+static size_t mmap_threshold = MMAP_THRESHOLD; /* Smallest mapped request */
+static int grow_policy = MM_GROW_ADAPTIVE;     /* How the heap is extended */
+static size_t chunksize = CHUNKSIZE;           /* Smallest heap extension */
 
 /* Function prototypes for internal helper routines: */
-static void *coalesce(void *bp);
-static void *extend_heap(size_t words);
-static void *find_fit(size_t asize);
-static void place(void *bp, size_t asize);
+static struct arena *get_arena(void);
+static void *malloc_locked(struct arena *a, size_t size, char **zerop);
+static size_t malloc_batch_locked(struct arena *a, size_t asize, size_t n,
+    void **out);
+static void free_locked(struct arena *a, void *bp);
+static void free_large(struct arena *a, void *bp);
+static void remote_free(struct arena *a, void *bp);
+static void drain_remote(struct arena *a);
+static void *resize_locked(struct arena *a, void *ptr, size_t size);
+static void *coalesce(struct arena *a, void *bp);
+static void *extend_heap(struct arena *a, size_t words, bool in_place);
+static size_t grow_size(struct arena *a);
+static void mark_pages(struct arena *a, void *lo, void *hi);
+static size_t adjust_size(size_t size);
+static size_t class_size(size_t size);
+static void *find_fit(struct arena *a, size_t asize);
+static void *wild_fit(struct arena *a, size_t asize);
+static char *wild_zero(struct arena *a, size_t asize);
+static void *alloc_aligned(struct arena *a, size_t asize, size_t align);
+static char *align_block(void *bp, size_t align);
+static bool aligned_fit(void *bp, size_t asize, size_t align);
+static void *free_block(struct arena *a, void *bp);
+static int trim_top(struct arena *a, size_t pad);
+static void *huge_alloc(size_t size);
+static void huge_free(void *bp);
+static void *huge_realloc(void *bp, size_t size);
+static bool quick_flush(struct arena *a);
+static void place(struct arena *a, void *bp, size_t asize);
+static int ptr_compare(const void *p, const void *q);
+static void trim_block(struct arena *a, void *bp, size_t asize);
+static struct bump_chunk *bump_chunk_new(struct mm_arena *ar, size_t size);
+static struct pool_slab *pool_slab_new(struct mm_pool *pool);
+static void pool_link(struct pool_slab **headp, struct pool_slab *slab);
+static void pool_unlink(struct pool_slab **headp, struct pool_slab *slab);
+static struct mm_handle *handle_new(void);
+static int handle_compare(const void *p, const void *q);
+static size_t compact_region(struct arena *a, struct region *region,
+    struct mm_handle **hv, size_t nh);
+static void close_hole(struct arena *a, char *hole, char *bp);
+
+/* Function prototypes for the maintenance thread: */
+static void *maint_main(void *arg);
+static void maint_pass(unsigned long *seen);
+
+/* Function prototypes for free list helper routines: */
+static inline int fls_size(size_t size);
+static void mapping(size_t asize, int *flp, int *slp);
+static void add_to_front(struct arena *a, void *bp);
+static void splice(struct arena *a, void *bp);
+
+/* Function prototypes for large free block tree routines: */
+static void *tree_fit(struct arena *a, size_t asize);
+static void tree_insert(struct tnode **rootp, struct tnode *n);
+static void tree_remove(struct tnode **rootp, struct tnode *n);
+static void tree_rebalance(struct tnode **path[], int depth);
+static struct tnode *tree_balance(struct tnode *root);
+static struct tnode *tree_rotate(struct tnode *root, bool left);
+static inline bool tree_less(struct tnode *x, struct tnode *y);
+static inline int tree_height(struct tnode *n);
+
+/* Function prototypes for small-object allocator routines: */
+static void *slab_alloc(struct arena *a, size_t size);
+static void slab_free(struct arena *a, void *p);
+static struct run *new_run(struct arena *a, uint32_t size);
+static void release_run(struct arena *a, struct run *run);
+static void release_empty_runs(struct arena *a);
+static void run_link(struct arena *a, struct run *run);
+static void run_unlink(struct arena *a, struct run *run);
+
+/* Function prototypes for thread cache routines: */
+static void *tcache_get(size_t size);
+static bool tcache_put(void *bp, size_t key);
+static void tcache_flush(void *arg);
+static void tcache_key_create(void);
 
 /* Function prototypes for heap consistency checker routines: */
+#ifdef MM_DEBUG
+static void checksized(void *bp, size_t size);
+#endif
 static void checkblock(void *bp);
 static void checkheap(bool verbose);
-static void printblock(void *bp); 
-
+static size_t checktree(struct arena *a, struct tnode *n, struct tnode *lo,
+    struct tnode *hi);
+static void printblock(void *bp);
 
-/* Function prototypes we added */
-//static void placeListFront(int bin, void *bp);
-static void add_to_front(void *bp);
-static void splice(struct node *nodep);
-//static int findBin(size_t asize);
-
-
-/* 
+/*
  * Requires:
  *   None.
  *
@@ -117,64 +621,103 @@ static void splice(struct node *nodep);
  *   successfully initialized and -1 otherwise.
  */
 int
-mm_init(void) 
+mm_init(void)
 {
-	/* Create the initial empty heap. */
-	
-	//struct node *head;
-	printf("INIT\n");
+	struct arena *a;
+	struct mm_handle *h;
+	size_t npages;
+	long ncpus;
+	int i;
+
+	/* Create one arena per processor the first time through. */
+	if (narenas == 0) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		narenas = (ncpus < 1) ? 1 :
+		    (ncpus > NARENAS_MAX) ? NARENAS_MAX : (int)ncpus;
+		for (i = 0; i < narenas; i++)
+			pthread_mutex_init(&arenas[i].lock, NULL);
+	}
 
-	if ((heap_listp = mem_sbrk(3 * WSIZE)) == (void *)-1)
-		return (-1);
+	/* Invalidate every thread's cache of blocks from the old heap. */
+	__atomic_store_n(&heap_gen, heap_gen + 1, __ATOMIC_RELEASE);
 
-	//PUT(heap_listp, 0);                            /* Alignment padding */
-	PUT(heap_listp, PACK(DSIZE, 1)); /* Prologue header */ 
-	PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-
-	printf("Prologue set\n");
-
-	//temp = heap_listp + (2 * WSIZE);
-	//head = (struct node *)temp;
-	//printf("Initialized head to be two words after the prologue start\n");
-
-	/* Insert the next and previous pointers, the head of the list */
-	/* Can use heap_listp + 2*WSIZE to access head of list */
-	/*PUT(heap_listp + (2 * WSIZE), head.next);
-	PUT(heap_listp + (3 * WSIZE), head.previous);*/
-
-	/*head->previous = head;
-	head->next = head;	
-	list_start = head;*/	
-	
-	PUT(heap_listp + (2 * WSIZE), PACK(0, 1));     /* Epilogue header */
-	heap_listp += (WSIZE);
-	printf("Epilogue set\n");
-
-	/* initialize each bin pointer to -1 */
-	/*for (int i = 0; i < binNum; i++) {
-		PUT(heap_listp + ((i + 2) * WSIZE), (uint64_t)(heap_listp + WSIZE));
-	}
-	list_start = heap_listp + ((binNum + 2) * WSIZE); */
-
-	checkheap(1);
-	
-	printf("Entering extend heap\n");
-	/* Extend the empty heap with a free block of CHUNKSIZE bytes. */
-	if (extend_heap(CHUNKSIZE / WSIZE) == NULL) {
-		printf("Failed INIT\n");
-		return (-1);
+	/*
+	 * Grow the heap at least a whole huge page at a time if memlib backs
+	 * it with huge pages.
+	 */
+	chunksize = MAX(CHUNKSIZE, mem_hugepage_size());
+
+	/* Empty every arena. */
+	for (i = 0; i < narenas; i++) {
+		a = &arenas[i];
+		pthread_mutex_lock(&a->lock);
+		a->fl_bitmap = 0;
+		memset(a->sl_bitmap, 0, sizeof(a->sl_bitmap));
+		memset(a->seg_heads, 0, sizeof(a->seg_heads));
+		a->tree = NULL;
+		memset(a->runs, 0, sizeof(a->runs));
+		memset(a->quick, 0, sizeof(a->quick));
+		a->nquick = 0;
+		a->top = NULL;
+		a->wild = NULL;
+		a->clean = NULL;
+		a->grow = chunksize;
+		a->nalloc = a->grow_mark = 0;
+		a->remote = NULL;
+		pthread_mutex_unlock(&a->lock);
 	}
-	
-	printf("Completed init!\n");
-	if (list_start == NULL)
-		printf("List start is NULL!\n");	
-	
-	checkheap(1);
 
+	/*
+	 * Map a page map that covers the largest heap memlib allows, or
+	 * zero the existing one, dropping its pages if it is large.  Either
+	 * way, its pages are only committed as the heap grows into the pages
+	 * they describe.  The map covers exactly the pages of the heap, which
+	 * is page-aligned, since a mapping may start right after the heap and
+	 * IS_HEAP must not mistake it for part of the heap.
+	 */
+	pthread_mutex_lock(&handle_lock);
+	while ((h = handles) != NULL) {
+		handles = h->next;
+		h->next = free_handles;
+		free_handles = h;
+	}
+	pthread_mutex_unlock(&handle_lock);
+	pthread_mutex_lock(&sbrk_lock);
+	regions = last_region = NULL;
+	npages = mem_heap_limit() / RUNSIZE;
+	if (npages != page_map_size) {
+		if (page_map != NULL)
+			munmap(page_map, page_map_size);
+		page_map = mmap(NULL, npages, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (page_map == MAP_FAILED) {
+			page_map = NULL;
+			page_map_size = 0;
+			pthread_mutex_unlock(&sbrk_lock);
+			return (-1);
+		}
+		page_map_size = npages;
+	} else if (page_map_size <= CHUNKSIZE * 16)
+		memset(page_map, 0, page_map_size);
+	else
+		madvise(page_map, page_map_size, MADV_DONTNEED);
+	heap_page = (uintptr_t)mem_heap_lo() >> RUN_SHIFT;
+	heap_base = mem_heap_lo();
+	pthread_mutex_unlock(&sbrk_lock);
+
+	/* Give the first arena an initial region of chunksize bytes. */
+	a = &arenas[0];
+	pthread_mutex_lock(&a->lock);
+	if (extend_heap(a, chunksize / WSIZE, false) == NULL) {
+		pthread_mutex_unlock(&a->lock);
+		return (-1);
+	}
+	pthread_mutex_unlock(&a->lock);
+	checkheap(false);
 	return (0);
 }
 
-/* 
+/*
  * Requires:
  *   None.
  *
@@ -184,43 +727,76 @@ mm_init(void)
  *   and NULL otherwise.
  */
 void *
-mm_malloc(size_t size) 
+mm_malloc(size_t size)
 {
-	size_t asize;      /* Adjusted block size */
-	size_t extendsize; /* Amount to extend heap if no fit */
+	struct arena *a;
 	void *bp;
 
-	printf("Start malloc\n");
 	/* Ignore spurious requests. */
 	if (size == 0)
 		return (NULL);
 
-	/* Adjust block size to include overhead and alignment reqs. */
-	/* Increased size to 4 words of overhead from 2 */
-	/* Smallest useable block size is now 2 words instead of 1 */
-	if (size <= ASIZE)
-		asize = ASIZE + QSIZE;
-	else
-		asize = ASIZE * ((size + QSIZE + (ASIZE - 1)) / ASIZE);
+	/* Give huge requests a mapping of their own. */
+	if (size >= mmap_threshold)
+		return (huge_alloc(size));
 
-	/* Search the free list for a fit. */
-	if ((bp = find_fit(asize)) != NULL) {
-		place(bp, asize);
+	/* Reuse a block from this thread's cache without taking a lock. */
+	if ((bp = tcache_get(size)) != NULL)
 		return (bp);
-	}
 
-	/* No fit found.  Get more memory and place the block. */
-	extendsize = MAX(asize, CHUNKSIZE);
-	if ((bp = extend_heap(extendsize / WSIZE)) == NULL)  
-		return (NULL);
+	a = get_arena();
+	pthread_mutex_lock(&a->lock);
+	drain_remote(a);
+	bp = malloc_locked(a, size, NULL);
+	pthread_mutex_unlock(&a->lock);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Allocate a zeroed block for an array of "nmemb" elements of "size"
+ *   bytes each, unless the array is empty or its size overflows.  Memory
+ *   that is known to be zero, because it is a fresh mapping or has not been
+ *   used since memlib obtained it, is not cleared again.  Returns the
+ *   address of this block if the allocation was successful and NULL
+ *   otherwise.
+ */
+void *
+mm_calloc(size_t nmemb, size_t size)
+{
+	struct arena *a;
+	char *bp, *zero;
 
-	place(bp, asize);
-	checkheap(1);
+	/* Ignore spurious requests. */
+	if (nmemb != 0 && size > SIZE_MAX / nmemb)
+		return (NULL);
+	size *= nmemb;
+	if (size == 0)
+		return (NULL);
 
+	/* A mapping of its own is already zero. */
+	if (size >= mmap_threshold)
+		return (huge_alloc(size));
+
+	if ((bp = tcache_get(size)) == NULL) {
+		a = get_arena();
+		pthread_mutex_lock(&a->lock);
+		drain_remote(a);
+		bp = malloc_locked(a, size, &zero);
+		pthread_mutex_unlock(&a->lock);
+		if (bp == NULL)
+			return (NULL);
+		if (zero != NULL && zero < bp + size)
+			size = zero - bp;
+	}
+	memset(bp, 0, size);
 	return (bp);
-} 
+}
 
-/* 
+/*
  * Requires:
  *   "bp" is either the address of an allocated block or NULL.
  *
@@ -230,22 +806,96 @@ mm_malloc(size_t size)
 void
 mm_free(void *bp)
 {
-	size_t size;
+	struct arena *a;
 
-	
 	/* Ignore spurious requests. */
 	if (bp == NULL)
 		return;
 
-	/* Free and coalesce the block. */
-	size = GET_SIZE(HDRP(bp));
+	/* Unmap a huge block. */
+	if (!IS_HEAP(bp)) {
+		huge_free(bp);
+		return;
+	}
 
-	/* Reset Header and Footer to be free */
-	PUT(HDRP(bp), PACK(size, 0));
-	PUT(FTRP(bp), PACK(size, 0));
-	coalesce(bp);
+	/* Keep the block in this thread's cache if there is room. */
+	if (tcache_put(bp, IS_RUN(bp) ? RUNP(bp)->size : GET_SIZE(HDRP(bp))))
+		return;
+
+	/*
+	 * Return the block to the arena that owns it.  If that is not this
+	 * thread's arena, leave the block for the arena's next allocation.
+	 */
+	a = OWNER(bp);
+	if (a != get_arena()) {
+		remote_free(a, bp);
+		return;
+	}
+	pthread_mutex_lock(&a->lock);
+	free_locked(a, bp);
+	pthread_mutex_unlock(&a->lock);
+}
+
+/*
+ * Requires:
+ *   "bp" is either the address of an allocated block or NULL.  If it is a
+ *   block, then it was returned by mm_malloc, mm_calloc, mm_malloc_batch,
+ *   mm_realloc, mm_realloc_sized, mm_memalign, or mm_aligned_alloc for a
+ *   request of "size" bytes, and the mmap threshold has not changed since.
+ *
+ * Effects:
+ *   Free a block like mm_free, but take its size class from "size" instead
+ *   of its header, so the block is cached without reading it.  Only a
+ *   slot-sized free reads the block's page, to tell a slot from a block
+ *   carved by mm_memalign.  If compiled with MM_DEBUG, aborts unless
+ *   "size" fits the block.
+ */
+void
+mm_free_sized(void *bp, size_t size)
+{
+	struct arena *a;
+
+	/* Ignore spurious requests. */
+	if (bp == NULL)
+		return;
+
+	/* Unmap a huge block. */
+	if (!IS_HEAP(bp)) {
+		huge_free(bp);
+		return;
+	}
+#ifdef MM_DEBUG
+	checksized(bp, size);
+#endif
+
+	/* A block from mm_memalign is never a slot, whatever its size. */
+	if (size <= SLAB_MAX && !IS_RUN(bp)) {
+		mm_free(bp);
+		return;
+	}
 
-	checkheap(1);
+	/* Keep the block in this thread's cache if there is room. */
+	if (tcache_put(bp, class_size(size)))
+		return;
+
+	/*
+	 * Return the block to the arena that owns it, going straight to the
+	 * slot's run if the block is a slot, and straight to coalescing if
+	 * the block is too large for the quick lists.
+	 */
+	a = OWNER(bp);
+	if (a != get_arena()) {
+		remote_free(a, bp);
+		return;
+	}
+	pthread_mutex_lock(&a->lock);
+	if (size <= SLAB_MAX)
+		slab_free(a, bp);
+	else if (class_size(size) > QUICK_MAX)
+		free_large(a, bp);
+	else
+		free_locked(a, bp);
+	pthread_mutex_unlock(&a->lock);
 }
 
 /*
@@ -257,13 +907,16 @@ mm_free(void *bp)
  *   payload, unless "size" is zero.  If "size" is zero, frees the block
  *   "ptr" and returns NULL.  If the block "ptr" is already a block with at
  *   least "size" bytes of payload, then "ptr" may optionally be returned.
- *   Otherwise, a new block is allocated and the contents of the old block
- *   "ptr" are copied to that new block.  Returns the address of this new
- *   block if the allocation was successful and NULL otherwise.
+ *   Otherwise, the block is grown in place into a free next block or by
+ *   extending the heap if it is the last block.  Only if neither is
+ *   possible is a new block allocated and the contents of the old block
+ *   "ptr" copied to that new block.  Returns the address of the resized or
+ *   new block if the reallocation was successful and NULL otherwise.
  */
 void *
 mm_realloc(void *ptr, size_t size)
 {
+	struct arena *a;
 	size_t oldsize;
 	void *newptr;
 
@@ -277,6 +930,33 @@ mm_realloc(void *ptr, size_t size)
 	if (ptr == NULL)
 		return (mm_malloc(size));
 
+	if (!IS_HEAP(ptr)) {
+		/* Remap a huge block that stays huge. */
+		if (size >= mmap_threshold)
+			return (huge_realloc(ptr, size));
+		oldsize = HUGE_SIZE(ptr) - HUGE_HDR;
+	} else {
+		/*
+		 * Try to resize the block in place within the arena that owns
+		 * it, unless the request is now huge.
+		 */
+		oldsize = IS_RUN(ptr) ? RUNP(ptr)->size :
+		    GET_SIZE(HDRP(ptr)) - WSIZE;
+		if (size < mmap_threshold) {
+			a = OWNER(ptr);
+			pthread_mutex_lock(&a->lock);
+			newptr = resize_locked(a, ptr, size);
+			pthread_mutex_unlock(&a->lock);
+			if (newptr != NULL)
+				return (newptr);
+		}
+	}
+
+	/*
+	 * The block cannot be resized in place, or the request now belongs in
+	 * a run or a mapping, so move it.  No lock is held here, so the new
+	 * block may come from this thread's own arena.
+	 */
 	newptr = mm_malloc(size);
 
 	/* If realloc() fails the original block is left untouched  */
@@ -284,134 +964,115 @@ mm_realloc(void *ptr, size_t size)
 		return (NULL);
 
 	/* Copy the old data. */
-	oldsize = GET_SIZE(HDRP(ptr));
 	if (size < oldsize)
 		oldsize = size;
 	memcpy(newptr, ptr, oldsize);
 
 	/* Free the old block. */
 	mm_free(ptr);
-	checkheap(1);
+
 	return (newptr);
 }
 
-/*
- * The following routines are internal helper routines.
- */
-
 /*
  * Requires:
- *   "bp" is the address of a newly freed block.
+ *   "ptr" is either the address of an allocated block or NULL.  If it is a
+ *   block, then it was returned for a request of "oldsize" bytes, as
+ *   mm_free_sized requires.
  *
  * Effects:
- *   Perform boundary tag coalescing.  Returns the address of the coalesced
- *   block.
+ *   Reallocates the block "ptr" like mm_realloc, but takes the block's
+ *   size class from "oldsize" instead of its header or its page, and copies
+ *   only "oldsize" bytes if the block moves.  If compiled with MM_DEBUG,
+ *   aborts unless "oldsize" fits the block.
  */
-static void *
-coalesce(void *bp) 
+void *
+mm_realloc_sized(void *ptr, size_t oldsize, size_t size)
 {
-	printf("Start coalesce\n");
-	if (bp == NULL)
-		printf("Pointer is NULL\n");
-	struct node *new_node;	
-	size_t size = GET_SIZE(HDRP(bp));
-	
-	printf("Got size\n");
-	bool prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
-	printf("Stored whether previous block was allocated\n");
-	bool next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-	printf("Stored whether the next block was allocated\n");
-	printf("Finished coalesce initializations\n");
-	if (prev_alloc && next_alloc) {                 /* Case 1 */
-		printf("Case 1\n");
-		return (bp);
-	} else if (prev_alloc && !next_alloc) {         /* Case 2 */
-		printf("Case 2\n");
-		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-		PUT(HDRP(bp), PACK(size, 0));
-		PUT(FTRP(bp), PACK(size, 0));
-		splice((struct node *)NEXT_BLKP(bp));
-	} else if (!prev_alloc && next_alloc) {         /* Case 3 */
-		printf("Case 3\n");
-		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-		PUT(FTRP(bp), PACK(size, 0));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-
-		/* Seems to work for now, but rather hackish */
-		/* the issue arises because bp is not actually in the list yet (I think) */
-		struct node *temp = (struct node *)bp;
-		if (temp->next != NULL)
-			splice(bp);
-		bp = PREV_BLKP((void *)bp);
-	} else {                                        /* Case 4 */
-		printf("Case 4\n");
-		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
-		    GET_SIZE(FTRP(NEXT_BLKP(bp)));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-		splice((struct node *)bp);
-		splice((struct node *)NEXT_BLKP(bp));
-		bp = PREV_BLKP(bp);
-	}
-	
-	new_node = (struct node *)coalesce(bp);
-	new_node->next = list_start;
-	new_node->previous = NULL;
-	list_start->previous = new_node;
-	list_start = new_node;
-	checkheap(1);
-	return (bp);
+	struct arena *a;
+	void *newptr;
+
+	/* If size == 0 then this is just free, and we return NULL. */
+	if (size == 0) {
+		mm_free_sized(ptr, oldsize);
+		return (NULL);
+	}
+
+	/* If oldptr is NULL, then this is just malloc. */
+	if (ptr == NULL)
+		return (mm_malloc(size));
+
+	if (!IS_HEAP(ptr)) {
+		/* Remap a huge block that stays huge. */
+		if (size >= mmap_threshold)
+			return (huge_realloc(ptr, size));
+	} else if (oldsize <= SLAB_MAX && IS_RUN(ptr)) {
+#ifdef MM_DEBUG
+		checksized(ptr, oldsize);
+#endif
+		/* A slot already holds any request in its size class. */
+		if (size <= SLAB_MAX && class_size(size) == class_size(oldsize))
+			return (ptr);
+	} else if (size < mmap_threshold) {
+#ifdef MM_DEBUG
+		checksized(ptr, oldsize);
+#endif
+		/* Try to resize the block in place. */
+		a = OWNER(ptr);
+		pthread_mutex_lock(&a->lock);
+		newptr = resize_locked(a, ptr, size);
+		pthread_mutex_unlock(&a->lock);
+		if (newptr != NULL)
+			return (newptr);
+	}
+
+	/* Move the block, as mm_realloc does. */
+	if ((newptr = mm_malloc(size)) == NULL)
+		return (NULL);
+	memcpy(newptr, ptr, size < oldsize ? size : oldsize);
+	mm_free_sized(ptr, oldsize);
+	return (newptr);
 }
 
-/* 
+/*
  * Requires:
- *   words: the number of words to increase the heap by
- *   next: next pointer at the end of the linked list, to be set to the 
- 	   header of the new block
+ *   None.
+ *
  * Effects:
- *   Extend the heap with a free block and return that block's address.
+ *   Allocate a block with at least "size" bytes of payload whose address is
+ *   a multiple of "alignment", unless "size" is zero or "alignment" is not
+ *   a power of two.  The block is carved out of a free block, and any space
+ *   before it is returned to the free lists.  Returns the address of this
+ *   block if the allocation was successful and NULL otherwise.
  */
-static void *
-extend_heap(size_t words) 
+void *
+mm_memalign(size_t alignment, size_t size)
 {
-	size_t size;
+	struct arena *a;
+	size_t asize;
 	void *bp;
 
-	/* Allocate an even number of words to maintain alignment. */
-	size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-
-	if ((bp = mem_sbrk(size)) == (void *)-1)  
-		return (NULL);
-	printf("Before extended block is added to the free list\n");
-	checkheap(1);
-	/* Initialize the new node pointers, next precedes previous */
-	/* The previous point points to the header of the previous block*/	
-	
-	/*PUT(bp, NULL);
-	PUT(bp + WSIZE, HDRP(next));*/
-
-	/* Initialize free block header/footer and the epilogue header. */
-	PUT(HDRP(bp), PACK(size, 0));         /* Free block header */
-	PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
-	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
-	
-	/* If list start is NULL, initialize the start to the pointer to the
-	 * added block
-	 */
-	if (list_start == NULL) {
-		list_start = (struct node *)bp;
-		list_start->next = list_start;
-		list_start->previous = list_start;
-	}
+	/* Ignore spurious requests. */
+	if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0)
+		return (NULL);
 
-	printf("For isolation\n");
+	/* Every block is already aligned to ASIZE bytes. */
+	if (alignment <= ASIZE)
+		return (mm_malloc(size));
 
-	add_to_front(bp);
-	printf("After extended block is added to the free list\n");
-	checkheap(1);
-	printf("Entering coalesce from extend_heap\n");
-	/* Coalesce if the previous block was free. */
-	return (coalesce(bp));
+	/*
+	 * Carve the block from the heap even if it is small or huge.  Make it
+	 * larger than any slot, so that the thread caches cannot mistake it
+	 * for one.
+	 */
+	if ((asize = adjust_size(MAX(size, SLAB_MAX + 1))) == 0)
+		return (NULL);
+	a = get_arena();
+	pthread_mutex_lock(&a->lock);
+	drain_remote(a);
+	bp = alloc_aligned(a, asize, alignment);
+	pthread_mutex_unlock(&a->lock);
+	return (bp);
 }
 
 /*
@@ -419,233 +1080,2773 @@ extend_heap(size_t words)
  *   None.
  *
  * Effects:
- *   Find a fit for a block with "asize" bytes.  Returns that block's address
- *   or NULL if no suitable block was found. 
+ *   Same as mm_memalign, as in C11's aligned_alloc.
  */
-static void *
-find_fit(size_t asize)
-{
-	//void *bp;
-	struct node *cur = list_start;
-	
-	
-	/* Iterate through the list, find first fit */
-	do {
-		if (asize <= GET_SIZE(HDRP(cur)))
-			return cur;
-		cur = cur->next;
-	} while (cur != list_start);
-	
-	/* Search for the first fit. 
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-		if (!GET_ALLOC(HDRP(bp)) && asize <= GET_SIZE(HDRP(bp)))
-			return (bp);
-	} */
-
-	/* No fit was found. */
-	return (NULL);
+void *
+mm_aligned_alloc(size_t alignment, size_t size)
+{
+
+	return (mm_memalign(alignment, size));
 }
 
-/* 
+/*
  * Requires:
- *   "bp" is the address of a free block that is at least "asize" bytes.
+ *   "out" has room for "n" addresses.
  *
  * Effects:
- *   Place a block of "asize" bytes at the start of the free block "bp" and
- *   split that block if the remainder would be at least the minimum block
- *   size. 
+ *   Allocate up to "n" blocks with at least "size" bytes of payload each,
+ *   unless "size" is zero, and store their addresses in "out".  The blocks
+ *   are taken from the quick list for their size and then carved out of a
+ *   single free block, so the free lists are updated once for the whole
+ *   batch.  Returns the number of blocks allocated, which is less than "n"
+ *   only if memory runs out.
  */
-static void
-place(void *bp, size_t asize)
+size_t
+mm_malloc_batch(size_t size, size_t n, void **out)
 {
-	size_t csize = GET_SIZE(HDRP(bp));
-	struct node *nodep = (struct node *) bp;
-	struct node *new_nodep;
-
-	/* increased size to account for next and previous pointer overhead */
-	if ((csize - asize) >= (ASIZE + QSIZE)) { 
-		PUT(HDRP(bp), PACK(asize, 1));
-		PUT(FTRP(bp), PACK(asize, 1));
-		
-		bp = NEXT_BLKP(bp);
-		PUT(HDRP(bp), PACK(csize - asize, 0));
-		PUT(FTRP(bp), PACK(csize - asize, 0));
-		
-		/* Set new node for the leftover free block */
-		new_nodep = (struct node *)bp;
-		
-		new_nodep->previous = nodep->previous;
-		new_nodep->next = nodep->next;
-				
-		/* Remove node from allocated block */
-		splice(nodep);
-		
-	} else {
-		PUT(HDRP(bp), PACK(csize, 1));
-		PUT(FTRP(bp), PACK(csize, 1));
-		
-		/* Remove node from allocated block */
-		splice(nodep);
-	}
-	checkheap(1);
-}
+	struct arena *a;
+	size_t asize, i = 0;
 
-static void
-add_to_front(void *bp)
-{
-	struct node *nodep = (struct node *)bp;
-	nodep->next = list_start;
-	nodep->previous = list_start->previous;
-	list_start->previous->next = nodep;
-	list_start->previous = nodep;
-	list_start = nodep;
+	/* Ignore spurious requests. */
+	if (size == 0)
+		return (0);
+
+	/* Give huge requests mappings of their own. */
+	if (size >= mmap_threshold) {
+		for (; i < n; i++)
+			if ((out[i] = huge_alloc(size)) == NULL)
+				break;
+		return (i);
+	}
 
+	/*
+	 * Carve as many blocks as possible at once, and allocate the rest,
+	 * including slots, one at a time under the same lock.
+	 */
+	a = get_arena();
+	pthread_mutex_lock(&a->lock);
+	drain_remote(a);
+	if (size > SLAB_MAX && (asize = adjust_size(size)) != 0)
+		i = malloc_batch_locked(a, asize, n, out);
+	for (; i < n; i++)
+		if ((out[i] = malloc_locked(a, size, NULL)) == NULL)
+			break;
+	pthread_mutex_unlock(&a->lock);
+	return (i);
 }
 
-static void
-splice(struct node *nodep)
-{
-	printf("Start splice\n");
-	if (nodep == NULL)
-		printf("Node pointer is NULL!\n");
-	if (nodep->previous == NULL)
-		printf("Node pointer's previous is NULL!\n");
-	if (nodep->next == NULL)
-		printf("Node pointer's next is NULL!\n");
-
-	nodep->previous->next = nodep->next;
-	nodep->next->previous = nodep->previous;
-	nodep->next = NULL;
-	nodep->previous = NULL;
-	printf("End splice\n");
-
-}
-
-/*
- * Requires:
- *   asize
- *
- * Effects:
- *   Returns bin where size is less than or equal to bin max
- */
-// int
-// findBin(size_t asize)
-// {	
-// 	if (asize <= 32)
-// 		return 0;
-// 	else if (asize <= 64)
-// 		return 1;
-// 	else if (asize <= 128)
-// 		return 2;
-// 	else if (asize <= 256)
-// 		return 3;
-// 	else if (asize <= 512)
-// 		return 4;
-// 	else if (asize <= 1024)
-// 		return 5;
-// 	else if (asize <= 2048)
-// 		return 6;
-// 	else if (asize <= 4096)
-// 		return 7;
-// 	else if (asize <= 8192)
-// 		return 8;
-// 	else if (asize <= 16384)
-// 		return 9;
-// 	else if (asize <= 32768)
-// 		return 10;
-// 	else
-// 		return 11;
-// }
-
-/*
- * Requires:
- *   Valid bin
- *   Valid pointer bp
- *
- * Effects:
- *   Put pointer's memory block in front of linked list for bin
- */
- 
-// static void
-// placeListFront(int bin, void *bp)
-// {
-// 	void *old_bp;
-// 
-// 	/* Find free block of bin*/
-// 	old_bp = (void *) GET((BIN_DIST(bin) + heap_listp));
-// 
-// 	/* Start at head of list */
-// 	if (old_bp != heap_listp) {
-// 		/* Set old head previous to be bp of new block */
-// 		SET_PREV(old_bp, bp);
-// 		/* Set new block next to be old bp */
-// 		SET_NEXT(bp, old_bp);
-// 	}
-// 	else{
-// 		SET_NEXT(bp, heap_listp);
-// 	}
-// 
-// 	/* Set previous of new block to NULL */
-// 	SET_PREV(bp, heap_listp);
-// 	/* Set bin to point to new head */
-// 	SET_NEXT(BIN_DIST(bin) + heap_listp, bp);
-// }
-
-
-/* 
- * The remaining routines are heap consistency checker routines. 
- */
-
 /*
  * Requires:
- *   "bp" is the address of a block.
+ *   Each of the "n" elements of "ptrs" is either the address of a distinct
+ *   allocated block or NULL.
  *
  * Effects:
- *   Perform a minimal check on the block "bp".
+ *   Free every block in "ptrs", sorting "ptrs" by address in the process.
+ *   Adjacent blocks are merged before they are freed, so a run of blocks
+ *   is coalesced and inserted into the free lists once, and each arena's
+ *   lock is taken once per run of its blocks.
  */
-static void
-checkblock(void *bp) 
+void
+mm_free_batch(void **ptrs, size_t n)
 {
-
-	if ((uintptr_t)bp % ASIZE)
-		printf("Error: %p is not word aligned\n", bp);
-	if (GET(HDRP(bp)) != GET(FTRP(bp)))
-		printf("Error: header does not match footer\n");
+	struct arena *a = NULL;
+	size_t i, j, size;
+	char *bp;
+
+	/* Sort "ptrs" unless it is already sorted, as mm_malloc_batch does. */
+	for (i = 1; i < n && (uintptr_t)ptrs[i - 1] <= (uintptr_t)ptrs[i]; i++)
+		continue;
+	if (i < n)
+		qsort(ptrs, n, sizeof(*ptrs), ptr_compare);
+	for (i = 0; i < n; i = j) {
+		bp = ptrs[i];
+		j = i + 1;
+		if (bp == NULL)
+			continue;
+		if (!IS_HEAP(bp)) {
+			huge_free(bp);
+			continue;
+		}
+		if (OWNER(bp) != a) {
+			if (a != NULL)
+				pthread_mutex_unlock(&a->lock);
+			a = OWNER(bp);
+			pthread_mutex_lock(&a->lock);
+		}
+
+		/* Merge the blocks that follow "bp" in the heap into it. */
+		if (!IS_RUN(bp)) {
+			size = GET_SIZE(HDRP(bp));
+			while (j < n && (char *)ptrs[j] == bp + size &&
+			    !IS_RUN(ptrs[j])) {
+				size += GET_SIZE(HDRP(ptrs[j]));
+				j++;
+			}
+			PUT(HDRP(bp), PACK(size, ALLOC |
+			    GET_PREV_ALLOC(HDRP(bp))));
+		}
+		free_locked(a, bp);
+	}
+	if (a != NULL)
+		pthread_mutex_unlock(&a->lock);
 }
 
-/* 
+/*
  * Requires:
  *   None.
  *
  * Effects:
- *   Perform a minimal check of the heap for consistency. 
+ *   Returns free memory at the end of the heap to memlib, keeping "pad"
+ *   bytes of it, rounded up to ASIZE, beyond a minimum-size free block.
+ *   Nothing is returned unless that releases at least a page.  The calling
+ *   thread's cache is flushed, blocks whose coalescing was deferred are
+ *   coalesced, and empty runs are released first.  Returns 1 if any memory
+ *   was returned and 0 otherwise.
  */
-void
-checkheap(bool verbose) 
+int
+mm_trim(size_t pad)
+{
+	struct arena *a;
+	int ret;
+
+	tcache_flush(&tcache);
+
+	/* Only the arena that owns the last region can shrink the heap. */
+	pthread_mutex_lock(&sbrk_lock);
+	a = (last_region != NULL) ? OWNER(last_region) : NULL;
+	pthread_mutex_unlock(&sbrk_lock);
+	if (a == NULL)
+		return (0);
+
+	pthread_mutex_lock(&a->lock);
+	drain_remote(a);
+	quick_flush(a);
+	release_empty_runs(a);
+	ret = trim_top(a, pad);
+	pthread_mutex_unlock(&a->lock);
+	return (ret);
+}
+
+/*
+ * Requires:
+ *   No other thread is using the memory manager.
+ *
+ * Effects:
+ *   Sets the tunable parameter "param" to "value".  MM_TRIM_THRESHOLD sets
+ *   the size of the free block at the end of the heap that makes mm_free
+ *   trim the heap.  MM_MMAP_THRESHOLD sets the smallest request that is
+ *   given a mapping of its own.  MM_GROW_POLICY sets how the heap is
+ *   extended, either MM_GROW_FIXED or MM_GROW_ADAPTIVE.  Returns 1 if
+ *   "param" and "value" are known and 0 otherwise.
+ */
+int
+mm_mallopt(int param, size_t value)
+{
+
+	switch (param) {
+	case MM_TRIM_THRESHOLD:
+		trim_threshold = value;
+		return (1);
+	case MM_MMAP_THRESHOLD:
+		if (value == 0)
+			return (0);
+		mmap_threshold = value;
+		return (1);
+	case MM_GROW_POLICY:
+		if (value != MM_GROW_FIXED && value != MM_GROW_ADAPTIVE)
+			return (0);
+		grow_policy = (int)value;
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Starts the maintenance thread, which wakes every "period_ms"
+ *   milliseconds, or every MAINT_PERIOD milliseconds if "period_ms" is
+ *   zero.  In each pass it completes the remote frees of every arena whose
+ *   lock is free, coalesces the quick lists of the arenas that have not
+ *   allocated since the last pass, and trims the heap's free tail once it
+ *   reaches the trim threshold.  While it runs, mm_free leaves trimming to
+ *   it.  If the thread is already running, only its period is changed.
+ *   Returns 0 if successful and -1 otherwise.  The thread must be stopped
+ *   before mm_init.
+ */
+int
+mm_maint_start(unsigned int period_ms)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&maint_lock);
+	maint_period = (period_ms == 0) ? MAINT_PERIOD : period_ms;
+	if (!maint_running) {
+		__atomic_store_n(&maint_running, true, __ATOMIC_RELAXED);
+		if (pthread_create(&maint_thread, NULL, maint_main, NULL) !=
+		    0) {
+			__atomic_store_n(&maint_running, false,
+			    __ATOMIC_RELAXED);
+			ret = -1;
+		}
+	} else
+		pthread_cond_signal(&maint_cond);
+	pthread_mutex_unlock(&maint_lock);
+	return (ret);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Stops the maintenance thread, if it is running, and waits for it to
+ *   exit.  mm_free trims the heap itself again.
+ */
+void
+mm_maint_stop(void)
+{
+
+	pthread_mutex_lock(&maint_lock);
+	if (!maint_running) {
+		pthread_mutex_unlock(&maint_lock);
+		return;
+	}
+	__atomic_store_n(&maint_running, false, __ATOMIC_RELAXED);
+	pthread_cond_signal(&maint_cond);
+	pthread_mutex_unlock(&maint_lock);
+	pthread_join(maint_thread, NULL);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Creates an empty bump arena whose chunks hold "chunk_size" bytes, or
+ *   BUMP_CHUNK bytes if "chunk_size" is zero.  Returns the arena if
+ *   successful and NULL otherwise.  A bump arena must not be used by two
+ *   threads at once, and it does not survive mm_init.
+ */
+struct mm_arena *
+mm_arena_create(size_t chunk_size)
+{
+	struct mm_arena *ar;
+
+	if (chunk_size > SIZE_MAX / 2 || (ar = mm_malloc(sizeof(*ar))) == NULL)
+		return (NULL);
+	ar->chunks = ar->current = NULL;
+	ar->ptr = ar->end = NULL;
+	ar->chunk_size = (chunk_size == 0) ? BUMP_CHUNK :
+	    (chunk_size + ASIZE - 1) / ASIZE * ASIZE;
+	return (ar);
+}
+
+/*
+ * Requires:
+ *   "ar" is a bump arena.
+ *
+ * Effects:
+ *   Allocates "size" bytes, aligned to ASIZE, from the bump arena "ar",
+ *   unless "size" is zero.  The memory is freed only by mm_arena_reset or
+ *   mm_arena_destroy.  A request larger than a quarter of a chunk gets a
+ *   chunk of its own, so that it does not waste the rest of the current
+ *   chunk.  Returns the address of the memory if successful and NULL
+ *   otherwise.
+ */
+void *
+mm_arena_alloc(struct mm_arena *ar, size_t size)
+{
+	struct bump_chunk *chunk;
+	void *p;
+
+	/* Ignore spurious requests. */
+	if (size == 0 || size > SIZE_MAX / 2)
+		return (NULL);
+	size = (size + ASIZE - 1) / ASIZE * ASIZE;
+
+	/* Bump the pointer if the request fits in the current chunk. */
+	if (size <= (size_t)(ar->end - ar->ptr)) {
+		p = ar->ptr;
+		ar->ptr += size;
+		return (p);
+	}
+
+	/* Give a large request a chunk of its own. */
+	if (size > ar->chunk_size / 4)
+		return ((chunk = bump_chunk_new(ar, size)) == NULL ? NULL :
+		    CHUNK_MEM(chunk));
+
+	/* Start a new current chunk. */
+	if ((chunk = bump_chunk_new(ar, ar->chunk_size)) == NULL)
+		return (NULL);
+	ar->current = chunk;
+	ar->ptr = CHUNK_MEM(chunk) + size;
+	ar->end = CHUNK_MEM(chunk) + chunk->size;
+	return (CHUNK_MEM(chunk));
+}
+
+/*
+ * Requires:
+ *   "ar" is a bump arena.
+ *
+ * Effects:
+ *   Frees everything allocated from the bump arena "ar" at once.  Every
+ *   chunk except the current one is returned to the heap, and the current
+ *   chunk is kept for the allocations that follow.
+ */
+void
+mm_arena_reset(struct mm_arena *ar)
+{
+	struct bump_chunk *chunk, *next;
+
+	for (chunk = ar->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		if (chunk != ar->current)
+			mm_free(chunk);
+	}
+	ar->chunks = ar->current;
+	if (ar->current != NULL) {
+		ar->current->next = NULL;
+		ar->ptr = CHUNK_MEM(ar->current);
+	}
+}
+
+/*
+ * Requires:
+ *   "ar" is either a bump arena or NULL.
+ *
+ * Effects:
+ *   Frees the bump arena "ar" and everything allocated from it.
+ */
+void
+mm_arena_destroy(struct mm_arena *ar)
+{
+
+	if (ar == NULL)
+		return;
+	ar->current = NULL;
+	mm_arena_reset(ar);
+	mm_free(ar);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Creates an empty pool of objects of "obj_size" bytes whose addresses
+ *   are multiples of "alignment", or of ASIZE if "alignment" is zero.
+ *   Returns the pool if successful and NULL otherwise, including when
+ *   "alignment" is not a power of two or either argument exceeds POOL_MAX.
+ *   A pool must not be used by two threads at once, and it does not
+ *   survive mm_init.
+ */
+struct mm_pool *
+mm_pool_create(size_t obj_size, size_t alignment)
+{
+	struct mm_pool *pool;
+
+	/* Ignore spurious requests. */
+	if (alignment == 0)
+		alignment = ASIZE;
+	if (obj_size == 0 || obj_size > POOL_MAX || alignment > POOL_MAX ||
+	    (alignment & (alignment - 1)) != 0)
+		return (NULL);
+
+	if ((pool = mm_malloc(sizeof(*pool))) == NULL)
+		return (NULL);
+	pool->partial = pool->full = NULL;
+
+	/*
+	 * An object must hold the free list link, and a slab must hold
+	 * POOL_MIN_OBJS objects after its header.
+	 */
+	alignment = MAX(alignment, ASIZE);
+	pool->size = (obj_size + alignment - 1) & ~(alignment - 1);
+	pool->offset = (sizeof(struct pool_slab) + alignment - 1) &
+	    ~(alignment - 1);
+	for (pool->slab_size = POOL_SLAB; pool->slab_size < pool->offset +
+	    POOL_MIN_OBJS * pool->size; pool->slab_size *= 2)
+		continue;
+	pool->nobjs = (pool->slab_size - pool->offset) / pool->size;
+	return (pool);
+}
+
+/*
+ * Requires:
+ *   "pool" is a pool.
+ *
+ * Effects:
+ *   Allocates an object from "pool", taking a new slab from the heap only
+ *   if every slab is full.  Returns the object's address if successful and
+ *   NULL otherwise.
+ */
+void *
+mm_pool_alloc(struct mm_pool *pool)
+{
+	struct pool_slab *slab;
+	void *p;
+
+	if ((slab = pool->partial) == NULL &&
+	    (slab = pool_slab_new(pool)) == NULL)
+		return (NULL);
+	if ((p = slab->free) != NULL)
+		slab->free = slab->free->next;
+	else {
+		p = slab->bump;
+		slab->bump += pool->size;
+	}
+	if (--slab->nfree == 0) {
+		pool_unlink(&pool->partial, slab);
+		pool_link(&pool->full, slab);
+	}
+	return (p);
+}
+
+/*
+ * Requires:
+ *   "p" is either an allocated object of "pool" or NULL.
+ *
+ * Effects:
+ *   Returns the object "p" to "pool".  A slab that becomes empty is
+ *   returned to the heap unless it is the pool's only slab with a free
+ *   object.
+ */
+void
+mm_pool_free(struct mm_pool *pool, void *p)
+{
+	struct pool_slab *slab;
+	struct node *nodep = p;
+
+	if (p == NULL)
+		return;
+	slab = POOL_SLABP(pool, p);
+	nodep->next = slab->free;
+	slab->free = nodep;
+	if (slab->nfree++ == 0) {
+		pool_unlink(&pool->full, slab);
+		pool_link(&pool->partial, slab);
+	}
+	if (slab->nfree == pool->nobjs &&
+	    (slab->next != NULL || slab->previous != NULL)) {
+		pool_unlink(&pool->partial, slab);
+		mm_free(slab);
+	}
+}
+
+/*
+ * Requires:
+ *   "pool" is either a pool or NULL.
+ *
+ * Effects:
+ *   Frees "pool" and every object allocated from it.
+ */
+void
+mm_pool_destroy(struct mm_pool *pool)
+{
+	struct pool_slab *slab;
+
+	if (pool == NULL)
+		return;
+	while ((slab = pool->partial) != NULL) {
+		pool->partial = slab->next;
+		mm_free(slab);
+	}
+	while ((slab = pool->full) != NULL) {
+		pool->full = slab->next;
+		mm_free(slab);
+	}
+	mm_free(pool);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Allocates a relocatable block with at least "size" bytes of payload,
+ *   unless "size" is zero, and returns a handle to it, or NULL if the
+ *   allocation failed.  The block's address is only valid between
+ *   mm_hlock and mm_hunlock.  A handle does not survive mm_init.
+ */
+struct mm_handle *
+mm_halloc(size_t size)
+{
+	struct mm_handle *h;
+	void *bp;
+
+	/* Ignore spurious requests. */
+	if (size == 0)
+		return (NULL);
+
+	/*
+	 * Make the block larger than any slot, so that it is a block that
+	 * mm_compact can move.
+	 */
+	if ((bp = mm_malloc(MAX(size, SLAB_MAX + 1))) == NULL)
+		return (NULL);
+	pthread_mutex_lock(&handle_lock);
+	if ((h = handle_new()) == NULL) {
+		pthread_mutex_unlock(&handle_lock);
+		mm_free(bp);
+		return (NULL);
+	}
+	h->ptr = bp;
+	h->locks = 0;
+	h->previous = NULL;
+	h->next = handles;
+	if (handles != NULL)
+		handles->previous = h;
+	handles = h;
+	pthread_mutex_unlock(&handle_lock);
+	return (h);
+}
+
+/*
+ * Requires:
+ *   "h" is either a handle or NULL.
+ *
+ * Effects:
+ *   Frees the handle "h" and its block, whether or not it is locked.
+ */
+void
+mm_hfree(struct mm_handle *h)
+{
+	void *bp;
+
+	if (h == NULL)
+		return;
+	pthread_mutex_lock(&handle_lock);
+	if (h->previous != NULL)
+		h->previous->next = h->next;
+	else
+		handles = h->next;
+	if (h->next != NULL)
+		h->next->previous = h->previous;
+	bp = h->ptr;
+	h->next = free_handles;
+	free_handles = h;
+	pthread_mutex_unlock(&handle_lock);
+	mm_free(bp);
+}
+
+/*
+ * Requires:
+ *   "h" is a handle.
+ *
+ * Effects:
+ *   Pins the block of the handle "h" in place and returns its address,
+ *   which stays valid until the matching mm_hunlock.  Locks nest.
+ */
+void *
+mm_hlock(struct mm_handle *h)
+{
+	void *ptr;
+
+	pthread_mutex_lock(&handle_lock);
+	h->locks++;
+	ptr = h->ptr;
+	pthread_mutex_unlock(&handle_lock);
+	return (ptr);
+}
+
+/*
+ * Requires:
+ *   "h" is a handle that is locked.
+ *
+ * Effects:
+ *   Undoes one mm_hlock of the handle "h".  Once no locks remain, the
+ *   block may be moved by mm_compact.
+ */
+void
+mm_hunlock(struct mm_handle *h)
+{
+
+	pthread_mutex_lock(&handle_lock);
+	h->locks--;
+	pthread_mutex_unlock(&handle_lock);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Compacts the heap.  Within each region, the blocks of unlocked
+ *   handles are slid toward the region's start, past free space, until
+ *   they reach a block that cannot move.  The free space between such
+ *   blocks is merged into a single free block, and the heap is then
+ *   trimmed.  Returns the number of blocks that were moved.
+ */
+size_t
+mm_compact(void)
+{
+	struct arena *a;
+	struct mm_handle *h, **hv;
+	struct region *region;
+	size_t hvsize, moved = 0, nh = 0;
+
+	/*
+	 * Collect the unlocked handles, sorted by address, in a mapping of
+	 * their own, so that the array does not pin the heap's tail.
+	 */
+	pthread_mutex_lock(&handle_lock);
+	for (h = handles; h != NULL; h = h->next)
+		nh++;
+	hvsize = MAX(nh, 1) * sizeof(*hv);
+	if ((hv = mmap(NULL, hvsize, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		pthread_mutex_unlock(&handle_lock);
+		return (0);
+	}
+	nh = 0;
+	for (h = handles; h != NULL; h = h->next)
+		if (h->locks == 0 && IS_HEAP(h->ptr))
+			hv[nh++] = h;
+	qsort(hv, nh, sizeof(*hv), handle_compare);
+
+	/*
+	 * Compact every region of each arena in turn.  Deferred frees are
+	 * completed first, so that their blocks are free.
+	 */
+	for (a = arenas; a < arenas + narenas; a++) {
+		pthread_mutex_lock(&a->lock);
+		drain_remote(a);
+		quick_flush(a);
+		pthread_mutex_lock(&sbrk_lock);
+		for (region = regions; region != NULL; region = region->next)
+			if (OWNER(region) == a)
+				moved += compact_region(a, region, hv, nh);
+		pthread_mutex_unlock(&sbrk_lock);
+		trim_top(a, MAX(TRIM_PAD, a->grow));
+		pthread_mutex_unlock(&a->lock);
+	}
+	pthread_mutex_unlock(&handle_lock);
+	munmap(hv, hvsize);
+	return (moved);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/*
+ * Requires:
+ *   mm_init has been called.
+ *
+ * Effects:
+ *   Returns this thread's arena, assigning the thread to the next arena
+ *   in round-robin order the first time it is called.
+ */
+static struct arena *
+get_arena(void)
+{
+	unsigned int i;
+
+	if (thread_arena == NULL) {
+		i = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+		thread_arena = &arenas[i % narenas];
+	}
+	return (thread_arena);
+}
+
+/*
+ * Requires:
+ *   "size" is not zero, and the lock of arena "a" is held.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload from arena "a".
+ *   Returns the address of this block if the allocation was successful and
+ *   NULL otherwise.  If "zerop" is not NULL, "*zerop" is set to the address
+ *   from which the block's payload is known to be zero, or NULL if none of
+ *   it is.
+ */
+static void *
+malloc_locked(struct arena *a, size_t size, char **zerop)
+{
+	size_t asize;      /* Adjusted block size */
+	size_t extendsize; /* Amount to extend heap if no fit */
+	void *bp;
+
+	if (zerop != NULL)
+		*zerop = NULL;
+
+	/* Serve small requests from a run. */
+	if (size <= SLAB_MAX)
+		return (slab_alloc(a, size));
+
+	/* Adjust block size to include overhead and alignment reqs. */
+	if ((asize = adjust_size(size)) == 0)
+		return (NULL);
+
+	a->nalloc++;
+
+	/* Reuse a block of exactly this size from its quick list. */
+	if (asize <= QUICK_MAX && (bp = a->quick[asize / ASIZE]) != NULL) {
+		a->quick[asize / ASIZE] = ((struct node *)bp)->next;
+		a->nquick--;
+		return (bp);
+	}
+
+	/*
+	 * Search the free lists for a fit, coalescing the blocks on the quick
+	 * lists first if nothing fits, and carve the block from the
+	 * wilderness only if there is still no fit.
+	 */
+	if ((bp = find_fit(a, asize)) != NULL ||
+	    (quick_flush(a) && (bp = find_fit(a, asize)) != NULL) ||
+	    (bp = wild_fit(a, asize)) != NULL) {
+		if (zerop != NULL && bp == a->wild)
+			*zerop = wild_zero(a, asize);
+		place(a, bp, asize);
+		return (bp);
+	}
+
+	/* No fit found.  Get more memory and place the block. */
+	extendsize = MAX(asize, grow_size(a));
+	if ((bp = extend_heap(a, extendsize / WSIZE, false)) == NULL)
+		return (NULL);
+	if (zerop != NULL)
+		*zerop = wild_zero(a, asize);
+	place(a, bp, asize);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   "asize" is a valid block size larger than SLAB_MAX, "out" has room for
+ *   "n" addresses, and the lock of arena "a" is held.
+ *
+ * Effects:
+ *   Allocate up to "n" blocks of "asize" bytes from arena "a", first from
+ *   the quick list for their size and then by carving them out of a single
+ *   free block, extending the heap if necessary.  Stores the addresses of
+ *   the blocks in "out" and returns their number.
+ */
+static size_t
+malloc_batch_locked(struct arena *a, size_t asize, size_t n, void **out)
+{
+	size_t csize, i = 0, k, total;
+	char *bp, *last = NULL;
+
+	/* Reuse the blocks of exactly this size on its quick list. */
+	if (asize <= QUICK_MAX) {
+		while (i < n && (bp = (char *)a->quick[asize / ASIZE]) !=
+		    NULL) {
+			a->quick[asize / ASIZE] = ((struct node *)bp)->next;
+			a->nquick--;
+			out[i++] = bp;
+		}
+	}
+
+	a->nalloc += i;
+
+	/* Find one free block that holds all of the remaining blocks. */
+	k = n - i;
+	if (k > (BLOCK_MAX - QSIZE) / asize)
+		k = (BLOCK_MAX - QSIZE) / asize;
+	if (k == 0)
+		return (i);
+	total = k * asize;
+	if ((bp = find_fit(a, total)) == NULL &&
+	    (!quick_flush(a) || (bp = find_fit(a, total)) == NULL) &&
+	    (bp = wild_fit(a, total)) == NULL &&
+	    (bp = extend_heap(a, MAX(total, grow_size(a)) / WSIZE, false)) ==
+	    NULL)
+		return (i);
+
+	/*
+	 * Carve the blocks from the front of the free block.  The last block
+	 * absorbs a remainder that is too small to be a block.
+	 */
+	csize = GET_SIZE(HDRP(bp));
+	splice(a, bp);
+	a->nalloc += k;
+	for (; k > 0; k--) {
+		PUT(HDRP(bp), PACK(asize, ALLOC | PREV_ALLOC));
+		out[i++] = last = bp;
+		bp = NEXT_PHYS_BLKP(bp);
+	}
+	if (csize - total >= QSIZE) {
+		PUT(HDRP(bp), PACK(csize - total, PREV_ALLOC));
+		PUT(FTRP(bp), PACK(csize - total, 0));
+		a->clean = MAX(a->clean, bp);
+		add_to_front(a, bp);
+	} else {
+		PUT(HDRP(last), PACK(asize + csize - total,
+		    ALLOC | PREV_ALLOC));
+		SET_PREV_ALLOC(HDRP(NEXT_PHYS_BLKP(last)));
+		a->clean = MAX(a->clean, NEXT_PHYS_BLKP(last));
+	}
+	return (i);
+}
+
+/*
+ * Requires:
+ *   Arena "a"'s wilderness is at least "asize" bytes, and the lock of arena
+ *   "a" is held.
+ *
+ * Effects:
+ *   Returns the address from which the payload of a block of "asize" bytes
+ *   placed at the start of the wilderness is known to be zero, or NULL if
+ *   the block would take the whole wilderness, including its footer.
+ */
+static char *
+wild_zero(struct arena *a, size_t asize)
+{
+
+	if (GET_SIZE(HDRP(a->wild)) - asize < QSIZE)
+		return (NULL);
+	return (MAX(a->clean, (char *)a->wild));
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block owned by arena "a", and the
+ *   lock of arena "a" is held.
+ *
+ * Effects:
+ *   Free a block to arena "a".  A block of at most QUICK_MAX bytes is
+ *   pushed onto its quick list without being coalesced.  Any other block
+ *   is coalesced, and the heap is trimmed if that leaves a free block of
+ *   at least the trim threshold at its end.
+ */
+static void
+free_locked(struct arena *a, void *bp)
+{
+	size_t size;
+
+	if (IS_RUN(bp)) {
+		slab_free(a, bp);
+		return;
+	}
+	if ((size = GET_SIZE(HDRP(bp))) <= QUICK_MAX) {
+		((struct node *)bp)->next = a->quick[size / ASIZE];
+		a->quick[size / ASIZE] = bp;
+		a->nquick++;
+		return;
+	}
+	free_large(a, bp);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block of more than QUICK_MAX
+ *   bytes owned by arena "a", and the lock of arena "a" is held.
+ *
+ * Effects:
+ *   Frees the block "bp" and coalesces it at once, then trims the heap if
+ *   that leaves a large enough free block at its end.
+ */
+static void
+free_large(struct arena *a, void *bp)
+{
+
+	/*
+	 * Give a large enough free tail back to memlib, unless that is left
+	 * to the maintenance thread.
+	 */
+	bp = free_block(a, bp);
+	if (GET_SIZE(HDRP(bp)) >= trim_threshold &&
+	    NEXT_PHYS_BLKP(bp) == a->top &&
+	    !__atomic_load_n(&maint_running, __ATOMIC_RELAXED))
+		trim_top(a, MAX(TRIM_PAD, a->grow));
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block owned by arena "a".
+ *
+ * Effects:
+ *   Pushes the block "bp" onto arena "a"'s stack of remote frees without
+ *   taking the arena's lock.
+ */
+static void
+remote_free(struct arena *a, void *bp)
+{
+	struct node *nodep = bp;
+
+	nodep->next = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&a->remote, &nodep->next, nodep,
+	    true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		continue;
+}
+
+/*
+ * Requires:
+ *   The lock of arena "a" is held.
+ *
+ * Effects:
+ *   Takes every block off arena "a"'s stack of remote frees and frees it.
+ */
+static void
+drain_remote(struct arena *a)
+{
+	struct node *bp, *next;
+
+	if (__atomic_load_n(&a->remote, __ATOMIC_RELAXED) == NULL)
+		return;
+	bp = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+	for (; bp != NULL; bp = next) {
+		next = bp->next;
+		free_locked(a, bp);
+	}
+}
+
+/*
+ * Requires:
+ *   "ptr" is the address of an allocated block owned by arena "a", "size"
+ *   is not zero, and the lock of arena "a" is held.
+ *
+ * Effects:
+ *   Resizes the block "ptr" in place as described for mm_realloc.  Returns
+ *   "ptr" if successful and NULL if the block must be moved.
+ */
+static void *
+resize_locked(struct arena *a, void *ptr, size_t size)
+{
+	size_t asize, csize, nsize;
+	void *next;
+
+	if (IS_RUN(ptr)) {
+		/* A slot holds any request that rounds up to its size. */
+		if ((size + ASIZE - 1) / ASIZE * ASIZE == RUNP(ptr)->size)
+			return (ptr);
+		return (NULL);
+	}
+	if (size <= SLAB_MAX || (asize = adjust_size(size)) == 0)
+		return (NULL);
+
+	/* Shrink the block in place, returning the tail to the heap. */
+	csize = GET_SIZE(HDRP(ptr));
+	if (asize <= csize) {
+		trim_block(a, ptr, asize);
+		return (ptr);
+	}
+
+	/*
+	 * Grow the block into a free next block, first extending the heap if
+	 * that block, or this one, is the last in the arena's last region.
+	 */
+	next = NEXT_PHYS_BLKP(ptr);
+	nsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+	if (csize + nsize < asize && (next == a->top ||
+	    (nsize != 0 && NEXT_PHYS_BLKP(next) == a->top)) &&
+	    extend_heap(a, MAX(asize - csize - nsize, QSIZE) / WSIZE, true) !=
+	    NULL)
+		nsize = GET_SIZE(HDRP(next));
+	if (csize + nsize < asize)
+		return (NULL);
+	splice(a, next);
+	PUT(HDRP(ptr), PACK(csize + nsize, ALLOC | GET_PREV_ALLOC(HDRP(ptr))));
+	SET_PREV_ALLOC(HDRP(NEXT_PHYS_BLKP(ptr)));
+	trim_block(a, ptr, asize);
+	a->clean = MAX(a->clean, NEXT_PHYS_BLKP(ptr));
+	return (ptr);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a newly freed block of arena "a" that is not yet
+ *   in any free list, and the next block's header already records "bp" as
+ *   free.
+ *
+ * Effects:
+ *   Perform boundary tag coalescing, removing any merged neighbors from
+ *   their free lists, and insert the coalesced block into the free list of
+ *   its size class.  Returns the address of the coalesced block.
+ */
+static void *
+coalesce(struct arena *a, void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	bool prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+	bool next_alloc = GET_ALLOC(HDRP(NEXT_PHYS_BLKP(bp)));
+
+	/*
+	 * The block before a free block is always allocated after coalescing,
+	 * so the merged block's header always has PREV_ALLOC set.
+	 */
+	if (prev_alloc && next_alloc) {                 /* Case 1 */
+		/* Nothing to merge. */
+	} else if (prev_alloc && !next_alloc) {         /* Case 2 */
+		size += GET_SIZE(HDRP(NEXT_PHYS_BLKP(bp)));
+		splice(a, NEXT_PHYS_BLKP(bp));
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+		PUT(FTRP(bp), PACK(size, 0));
+	} else if (!prev_alloc && next_alloc) {         /* Case 3 */
+		size += GET_SIZE(HDRP(PREV_PHYS_BLKP(bp)));
+		bp = PREV_PHYS_BLKP(bp);
+		splice(a, bp);
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+		PUT(FTRP(bp), PACK(size, 0));
+	} else {                                        /* Case 4 */
+		size += GET_SIZE(HDRP(PREV_PHYS_BLKP(bp))) +
+		    GET_SIZE(HDRP(NEXT_PHYS_BLKP(bp)));
+		splice(a, NEXT_PHYS_BLKP(bp));
+		bp = PREV_PHYS_BLKP(bp);
+		splice(a, bp);
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+		PUT(FTRP(bp), PACK(size, 0));
+	}
+	add_to_front(a, bp);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   The lock of arena "a" is held.
+ *
+ * Effects:
+ *   Extend arena "a" with a free block of at least "words" words and
+ *   return that block's address.  The arena's last region is grown in
+ *   place if it ends the heap and stays within BLOCK_MAX bytes, so that
+ *   no coalesced block outgrows its header.  Otherwise, a new region is
+ *   started unless "in_place" is true, in which case NULL is returned.
+ *   Returns NULL if the heap would exceed HEAP_MAX bytes, the most that
+ *   the free list links can address.
+ */
+static void *
+extend_heap(struct arena *a, size_t words, bool in_place)
+{
+	struct region *region;
+	char *brk, *lo, *zero;
+	size_t size, pad;
+	void *bp, *wild = NULL;
+
+	/* Allocate an even number of words to maintain alignment. */
+	size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+	if (size > BLOCK_MAX - sizeof(struct region) - DSIZE)
+		return (NULL);
+
+	pthread_mutex_lock(&sbrk_lock);
+	brk = (char *)mem_heap_hi() + 1;
+	zero = mem_zero_lo();
+	if (a->top == brk &&
+	    (size_t)(brk - (char *)last_region) <= BLOCK_MAX - size) {
+		if ((size_t)(brk - heap_base) > HEAP_MAX - size ||
+		    (bp = mem_sbrk(size)) == (void *)-1)
+			goto fail;
+		lo = bp;
+
+		/*
+		 * The old epilogue header, which becomes the new block's
+		 * header, records whether the last block is allocated.
+		 */
+		PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+	} else {
+		if (in_place)
+			goto fail;
+
+		/*
+		 * Start the region on a fresh page so that it shares no page
+		 * with another arena.  A region that is not the first one is
+		 * made large enough that the arena rarely needs another.
+		 */
+		pad = 0;
+		if (brk != mem_heap_lo()) {
+			pad = (RUNSIZE - ((uintptr_t)brk & (RUNSIZE - 1))) &
+			    (RUNSIZE - 1);
+			size = MAX(size, REGIONSIZE);
+		}
+		if ((size_t)(brk - heap_base) > HEAP_MAX - pad -
+		    sizeof(struct region) - DSIZE - size ||
+		    (lo = mem_sbrk(pad + sizeof(struct region) + WSIZE + size +
+		    WSIZE)) == (void *)-1)
+			goto fail;
+		wild = a->wild;
+		a->wild = NULL;
+		lo += pad;
+		region = (struct region *)lo;
+		region->next = NULL;
+		if (last_region != NULL)
+			last_region->next = region;
+		else
+			regions = region;
+		last_region = region;
+
+		/* Initialize the prologue and the new block's header. */
+		bp = REGION_PROLOGUE(region);
+		PUT(HDRP(bp), PACK(DSIZE, ALLOC | PREV_ALLOC));
+		PUT(bp, 0);
+		bp = NEXT_PHYS_BLKP(bp);
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+	}
+
+	/* Initialize the free block footer and the epilogue header. */
+	PUT(FTRP(bp), PACK(size, 0));
+	PUT(HDRP(NEXT_PHYS_BLKP(bp)), PACK(0, ALLOC));
+	a->top = NEXT_PHYS_BLKP(bp);
+	mark_pages(a, lo, a->top);
+	pthread_mutex_unlock(&sbrk_lock);
+
+	/*
+	 * The new block's payload is zero from where memlib's memory was last
+	 * zeroed, except for its footer.  Coalescing keeps the wilderness zero
+	 * from there on.
+	 */
+	a->clean = MAX((char *)bp, zero);
+
+	/*
+	 * The old wilderness, if any, no longer ends the arena's last region,
+	 * so it becomes an ordinary free block.
+	 */
+	if (wild != NULL)
+		add_to_front(a, wild);
+
+	/* Coalesce if the previous block was free. */
+	return (coalesce(a, bp));
+fail:
+	pthread_mutex_unlock(&sbrk_lock);
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   The lock of arena "a" is held.
+ *
+ * Effects:
+ *   Returns the number of bytes by which to extend arena "a" when no free
+ *   block fits a request.  Under MM_GROW_FIXED, this is always chunksize.
+ *   Under MM_GROW_ADAPTIVE, the extension doubles each time the arena runs
+ *   out of memory again within GROW_DECAY allocations and halves when it
+ *   takes longer, and it stays between chunksize and the smaller of
+ *   GROW_MAX and 1/GROW_RATIO of the heap.
+ */
+static size_t
+grow_size(struct arena *a)
+{
+	size_t limit;
+
+	if (grow_policy == MM_GROW_FIXED)
+		return (chunksize);
+	pthread_mutex_lock(&sbrk_lock);
+	limit = mem_heapsize() / GROW_RATIO;
+	pthread_mutex_unlock(&sbrk_lock);
+	limit = MAX(chunksize, limit < GROW_MAX ? limit : GROW_MAX);
+	if (a->nalloc - a->grow_mark <= GROW_DECAY)
+		a->grow *= 2;
+	else
+		a->grow /= 2;
+	a->grow = MAX(chunksize, a->grow < limit ? a->grow : limit);
+	a->grow_mark = a->nalloc;
+	return (a->grow);
+}
+
+/*
+ * Requires:
+ *   "lo" is less than "hi", and sbrk_lock is held.
+ *
+ * Effects:
+ *   Records arena "a" as the owner of every page from "lo" up to, but not
+ *   including, "hi".
+ */
+static void
+mark_pages(struct arena *a, void *lo, void *hi)
+{
+	uintptr_t page;
+
+	for (page = PAGE_NUM(lo); page <= PAGE_NUM((char *)hi - 1); page++)
+		PAGE_PUT(page, (PAGE_GET(page) & PAGE_RUN) | (a - arenas));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the size of the block needed for a request of "size" bytes,
+ *   including the header and alignment padding, or 0 if no block can be
+ *   that large.  A block must be large enough to hold the free list links
+ *   and footer once it is freed.
+ */
+static size_t
+adjust_size(size_t size)
+{
+
+	if (size > BLOCK_MAX - QSIZE)
+		return (0);
+	if (size <= QSIZE - WSIZE)
+		return (QSIZE);
+	return (ASIZE * ((size + WSIZE + (ASIZE - 1)) / ASIZE));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the size class of a request of "size" bytes: the size of the
+ *   slot that holds the request if it is at most SLAB_MAX bytes, and
+ *   otherwise the size of the block it needs, or 0 if no block can be that
+ *   large.
+ */
+static size_t
+class_size(size_t size)
+{
+
+	if (size <= SLAB_MAX)
+		return ((size + ASIZE - 1) / ASIZE * ASIZE);
+	return (adjust_size(size));
+}
+
+/*
+ * Requires:
+ *   The lock of arena "a" is held.
+ *
+ * Effects:
+ *   Find a fit in arena "a" for a block with "asize" bytes.  Returns that
+ *   block's address or NULL if no suitable block was found.
+ */
+static void *
+find_fit(struct arena *a, size_t asize)
+{
+	uint32_t map;
+	int fl, sl;
+
+	if (asize > BLOCK_MAX)
+		return (NULL);
+	if (asize >= TREE_MIN)
+		return (tree_fit(a, asize));
+
+	/* The head of the request's own list fits often enough to try first. */
+	mapping(asize, &fl, &sl);
+	if (a->seg_heads[fl][sl] != NULL &&
+	    asize <= GET_SIZE(HDRP(a->seg_heads[fl][sl])))
+		return (a->seg_heads[fl][sl]);
+
+	/*
+	 * Round the request up to the next list boundary, so that every block
+	 * in any list at or above the rounded class is large enough.
+	 */
+	if (asize >= SMALL_BLOCK)
+		asize += ((size_t)1 << (fls_size(asize) - SL_SHIFT)) - 1;
+	if (asize >= TREE_MIN)
+		return (tree_fit(a, asize));
+	mapping(asize, &fl, &sl);
+
+	/*
+	 * Find the first non-empty list in this range, else in a larger one,
+	 * else take the smallest block in the tree.
+	 */
+	map = a->sl_bitmap[fl] & (~0U << sl);
+	if (map == 0) {
+		map = a->fl_bitmap & (~0U << fl << 1);
+		if (map == 0)
+			return (tree_fit(a, asize));
+		fl = __builtin_ctz(map);
+		map = a->sl_bitmap[fl];
+	}
+	sl = __builtin_ctz(map);
+	return (a->seg_heads[fl][sl]);
+}
+
+/*
+ * Requires:
+ *   The lock of arena "a" is held.
+ *
+ * Effects:
+ *   Returns arena "a"'s wilderness block if it is at least "asize" bytes
+ *   and NULL otherwise.
+ */
+static void *
+wild_fit(struct arena *a, size_t asize)
+{
+
+	if (a->wild != NULL && GET_SIZE(HDRP(a->wild)) >= asize)
+		return (a->wild);
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   "asize" is a valid block size, "align" is a power of two that is at
+ *   least ASIZE, and the lock of arena "a" is held.
+ *
+ * Effects:
+ *   Allocate a block of "asize" bytes from arena "a" whose address is
+ *   aligned to "align" bytes, extending the heap if no free block is large
+ *   enough.  Any space before the block becomes a free block.  Returns the
+ *   address of the block if successful and NULL otherwise.
+ */
+static void *
+alloc_aligned(struct arena *a, size_t asize, size_t align)
+{
+	size_t csize, lead, need;
+	char *abp;
+	void *bp;
+	bool flushed;
+
+	/*
+	 * First try the block that an unaligned request would get and the
+	 * wilderness, either of which may already hold an aligned block.
+	 * Otherwise, any free block of "csize" bytes holds an aligned block
+	 * and a leading free block that is either empty or at least the
+	 * minimum size.  Flush the quick lists once before giving up.
+	 */
+	csize = asize + align + QSIZE;
+	for (flushed = false; ; flushed = true) {
+		if (((bp = find_fit(a, asize)) != NULL &&
+		    aligned_fit(bp, asize, align)) ||
+		    ((bp = a->wild) != NULL &&
+		    aligned_fit(bp, asize, align)) ||
+		    (bp = find_fit(a, csize)) != NULL)
+			break;
+		if (flushed || !quick_flush(a))
+			break;
+	}
+	if (bp == NULL) {
+		/*
+		 * Extend the heap by just enough to hold the aligned block at
+		 * its end.  If the heap cannot be grown in place, extend it
+		 * again by "csize" bytes, which always suffices.
+		 */
+		if (a->top != NULL) {
+			bp = (a->wild != NULL) ? a->wild : a->top;
+			need = align_block(bp, align) + asize - a->top;
+		} else
+			need = csize;
+		if ((bp = extend_heap(a, MAX(need, grow_size(a)) / WSIZE,
+		    false)) == NULL)
+			return (NULL);
+		if (!aligned_fit(bp, asize, align) &&
+		    (bp = extend_heap(a, csize / WSIZE, false)) == NULL)
+			return (NULL);
+	}
+	abp = align_block(bp, align);
+
+	/* Split off the leading free block, if any, then trim the tail. */
+	csize = GET_SIZE(HDRP(bp));
+	lead = abp - (char *)bp;
+	splice(a, bp);
+	if (lead != 0) {
+		PUT(HDRP(bp), PACK(lead, PREV_ALLOC));
+		PUT(FTRP(bp), PACK(lead, 0));
+		add_to_front(a, bp);
+		PUT(HDRP(abp), PACK(csize - lead, ALLOC));
+	} else
+		PUT(HDRP(abp), PACK(csize, ALLOC | PREV_ALLOC));
+	SET_PREV_ALLOC(HDRP(NEXT_PHYS_BLKP(abp)));
+	trim_block(a, abp, asize);
+	a->clean = MAX(a->clean, NEXT_PHYS_BLKP(abp));
+	return (abp);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a block, and "align" is a power of two that is
+ *   at least ASIZE.
+ *
+ * Effects:
+ *   Returns the lowest address in the block "bp" that is aligned to
+ *   "align" bytes and leaves a leading block before it that is either
+ *   empty or at least the minimum size.
+ */
+static char *
+align_block(void *bp, size_t align)
+{
+	char *abp = (char *)(((uintptr_t)bp + align - 1) & ~(align - 1));
+
+	if (abp != bp && (size_t)(abp - (char *)bp) < QSIZE)
+		abp += align;
+	return (abp);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block, and "align" is a power of two
+ *   that is at least ASIZE.
+ *
+ * Effects:
+ *   Returns true if the free block "bp" holds a block of "asize" bytes
+ *   aligned to "align" bytes, as align_block places it.
+ */
+static bool
+aligned_fit(void *bp, size_t asize, size_t align)
+{
+
+	return (align_block(bp, align) + asize <=
+	    (char *)bp + GET_SIZE(HDRP(bp)));
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block of arena "a", and the lock
+ *   of arena "a" is held.
+ *
+ * Effects:
+ *   Free the block "bp" and coalesce it with any free neighbors.  Returns
+ *   the address of the coalesced block.
+ */
+static void *
+free_block(struct arena *a, void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+
+	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+	PUT(FTRP(bp), PACK(size, 0));
+	CLEAR_PREV_ALLOC(HDRP(NEXT_PHYS_BLKP(bp)));
+	return (coalesce(a, bp));
+}
+
+/*
+ * Requires:
+ *   The lock of arena "a" is held.
+ *
+ * Effects:
+ *   If arena "a"'s last region ends the heap with a free block of at least
+ *   a page more than the minimum block size plus "pad" bytes, shrinks the
+ *   heap so that exactly "pad" bytes, rounded up to ASIZE, remain in that
+ *   block beyond the minimum block size.  Returns 1 if the heap was shrunk
+ *   and 0 otherwise.
+ */
+static int
+trim_top(struct arena *a, size_t pad)
+{
+	size_t size, release;
+	void *bp;
+	int ret = 0;
+
+	pthread_mutex_lock(&sbrk_lock);
+	if (a->top != (char *)mem_heap_hi() + 1 || GET_PREV_ALLOC(HDRP(a->top)))
+		goto out;
+	bp = PREV_PHYS_BLKP(a->top);
+	size = GET_SIZE(HDRP(bp));
+	if (size < QSIZE + pad + CHUNKSIZE)
+		goto out;
+	release = (size - QSIZE - pad) & ~(size_t)(ASIZE - 1);
+
+	/* Shorten the block and move the epilogue before shrinking. */
+	splice(a, bp);
+	size -= release;
+	PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+	PUT(FTRP(bp), PACK(size, 0));
+	a->top = NEXT_PHYS_BLKP(bp);
+	PUT(HDRP(a->top), PACK(0, ALLOC));
+	add_to_front(a, bp);
+	mem_sbrk(-(intptr_t)release);
+	ret = 1;
+out:
+	pthread_mutex_unlock(&sbrk_lock);
+	return (ret);
+}
+
+/*
+ * Requires:
+ *   The lock of arena "a" is held.
+ *
+ * Effects:
+ *   Frees and coalesces every block on arena "a"'s quick lists.  Returns
+ *   true if there were any such blocks and false otherwise.
+ */
+static bool
+quick_flush(struct arena *a)
+{
+	struct node *bp;
+	size_t i;
+
+	if (a->nquick == 0)
+		return (false);
+	for (i = 0; i < QUICK_MAX / ASIZE + 1; i++) {
+		while ((bp = a->quick[i]) != NULL) {
+			a->quick[i] = bp->next;
+			free_block(a, bp);
+		}
+	}
+	a->nquick = 0;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block of arena "a" that is at least
+ *   "asize" bytes.
+ *
+ * Effects:
+ *   Place a block of "asize" bytes at the start of the free block "bp" and
+ *   split that block if the remainder would be at least the minimum block
+ *   size.  The remainder is moved to the free list of its size class.
+ */
+static void
+place(struct arena *a, void *bp, size_t asize)
+{
+	size_t csize = GET_SIZE(HDRP(bp));
+
+	/* A free block's previous block is always allocated. */
+	splice(a, bp);
+	if ((csize - asize) >= QSIZE) {
+		PUT(HDRP(bp), PACK(asize, ALLOC | PREV_ALLOC));
+		bp = NEXT_PHYS_BLKP(bp);
+		PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOC));
+		PUT(FTRP(bp), PACK(csize - asize, 0));
+		a->clean = MAX(a->clean, (char *)bp);
+		add_to_front(a, bp);
+	} else {
+		PUT(HDRP(bp), PACK(csize, ALLOC | PREV_ALLOC));
+		SET_PREV_ALLOC(HDRP(NEXT_PHYS_BLKP(bp)));
+		a->clean = MAX(a->clean, NEXT_PHYS_BLKP(bp));
+	}
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block of arena "a" of at least
+ *   "asize" bytes.
+ *
+ * Effects:
+ *   Shrink the block "bp" to "asize" bytes if the remainder would be at
+ *   least the minimum block size, freeing the remainder and coalescing it
+ *   with the next block if that block is free.
+ */
+static void
+trim_block(struct arena *a, void *bp, size_t asize)
+{
+	size_t csize = GET_SIZE(HDRP(bp));
+
+	if ((csize - asize) < QSIZE)
+		return;
+	PUT(HDRP(bp), PACK(asize, ALLOC | GET_PREV_ALLOC(HDRP(bp))));
+	bp = NEXT_PHYS_BLKP(bp);
+	PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOC));
+	PUT(FTRP(bp), PACK(csize - asize, 0));
+	CLEAR_PREV_ALLOC(HDRP(NEXT_PHYS_BLKP(bp)));
+	coalesce(a, bp);
+}
+
+/*
+ * Requires:
+ *   "p" and "q" are the addresses of elements of an array of pointers.
+ *
+ * Effects:
+ *   Compares the pointers at "p" and "q" by address for qsort.
+ */
+static int
+ptr_compare(const void *p, const void *q)
+{
+	uintptr_t x = (uintptr_t)*(void * const *)p;
+	uintptr_t y = (uintptr_t)*(void * const *)q;
+
+	return ((x > y) - (x < y));
+}
+
+/*
+ * Requires:
+ *   "ar" is a bump arena, and "size" is a multiple of ASIZE.
+ *
+ * Effects:
+ *   Allocates a chunk with "size" bytes of memory and adds it to the bump
+ *   arena "ar"'s chunks.  Returns the chunk if successful and NULL
+ *   otherwise.
+ */
+static struct bump_chunk *
+bump_chunk_new(struct mm_arena *ar, size_t size)
+{
+	struct bump_chunk *chunk;
+
+	if ((chunk = mm_malloc(sizeof(*chunk) + size)) == NULL)
+		return (NULL);
+	chunk->size = size;
+	chunk->next = ar->chunks;
+	ar->chunks = chunk;
+	return (chunk);
+}
+
+/*
+ * Requires:
+ *   "pool" is a pool.
+ *
+ * Effects:
+ *   Allocates an empty slab for "pool", aligned to its size, and puts it
+ *   on the pool's list of slabs with a free object.  Returns the slab if
+ *   successful and NULL otherwise.
+ */
+static struct pool_slab *
+pool_slab_new(struct mm_pool *pool)
+{
+	struct pool_slab *slab;
+
+	if ((slab = mm_memalign(pool->slab_size, pool->slab_size)) == NULL)
+		return (NULL);
+	slab->free = NULL;
+	slab->bump = (char *)slab + pool->offset;
+	slab->nfree = pool->nobjs;
+	pool_link(&pool->partial, slab);
+	return (slab);
+}
+
+/*
+ * Requires:
+ *   "slab" is not on any list.
+ *
+ * Effects:
+ *   Inserts "slab" at the front of the list at "headp".
+ */
+static void
+pool_link(struct pool_slab **headp, struct pool_slab *slab)
+{
+
+	slab->previous = NULL;
+	slab->next = *headp;
+	if (*headp != NULL)
+		(*headp)->previous = slab;
+	*headp = slab;
+}
+
+/*
+ * Requires:
+ *   "slab" is on the list at "headp".
+ *
+ * Effects:
+ *   Removes "slab" from the list at "headp".
+ */
+static void
+pool_unlink(struct pool_slab **headp, struct pool_slab *slab)
+{
+
+	if (slab->previous != NULL)
+		slab->previous->next = slab->next;
+	else
+		*headp = slab->next;
+	if (slab->next != NULL)
+		slab->next->previous = slab->previous;
+	slab->next = slab->previous = NULL;
+}
+
+/*
+ * Requires:
+ *   The handle lock is held.
+ *
+ * Effects:
+ *   Takes an unused handle, mapping HANDLE_CHUNK bytes of new handles if
+ *   there are none.  Returns the handle if successful and NULL otherwise.
+ */
+static struct mm_handle *
+handle_new(void)
+{
+	struct mm_handle *h;
+	size_t i;
+
+	if (free_handles == NULL) {
+		h = mmap(NULL, HANDLE_CHUNK, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (h == MAP_FAILED)
+			return (NULL);
+		for (i = 0; i < HANDLE_CHUNK / sizeof(*h); i++) {
+			h[i].next = free_handles;
+			free_handles = &h[i];
+		}
+	}
+	h = free_handles;
+	free_handles = h->next;
+	return (h);
+}
+
+/*
+ * Requires:
+ *   "p" and "q" are the addresses of elements of an array of handles.
+ *
+ * Effects:
+ *   Compares the blocks of the handles at "p" and "q" by address for qsort.
+ */
+static int
+handle_compare(const void *p, const void *q)
+{
+	uintptr_t x = (uintptr_t)(*(struct mm_handle * const *)p)->ptr;
+	uintptr_t y = (uintptr_t)(*(struct mm_handle * const *)q)->ptr;
+
+	return ((x > y) - (x < y));
+}
+
+/*
+ * Requires:
+ *   "region" is a region of arena "a", the "nh" elements of "hv" are the
+ *   unlocked handles sorted by address, the locks of arena "a" and of the
+ *   heap are held, and no block of arena "a" is on a quick list.
+ *
+ * Effects:
+ *   Slides the blocks of the handles in "hv" that lie in "region" toward
+ *   the region's start, updating their handles, and merges the free space
+ *   between the blocks that cannot move.  Returns the number of blocks that
+ *   were moved.
+ */
+static size_t
+compact_region(struct arena *a, struct region *region, struct mm_handle **hv,
+    size_t nh)
+{
+	char *bp, *next, *hole = NULL;
+	size_t i = 0, moved = 0, size;
+
+	bp = NEXT_PHYS_BLKP(REGION_PROLOGUE(region));
+	for (; GET_SIZE(HDRP(bp)) > 0; bp = next) {
+		size = GET_SIZE(HDRP(bp));
+		next = bp + size;
+		while (i < nh && (char *)hv[i]->ptr < bp)
+			i++;
+		if (!GET_ALLOC(HDRP(bp))) {
+			/* Take the free block into the hole. */
+			splice(a, bp);
+			if (hole == NULL)
+				hole = bp;
+		} else if (hole != NULL && i < nh && hv[i]->ptr == bp) {
+			/* Slide the handle's block to the start of the hole. */
+			memmove(HDRP(hole), HDRP(bp), size);
+			PUT(HDRP(hole), PACK(size, ALLOC | PREV_ALLOC));
+			hv[i]->ptr = hole;
+			hole += size;
+			moved++;
+		} else if (hole != NULL) {
+			/* The hole ends at a block that cannot move. */
+			close_hole(a, hole, bp);
+			hole = NULL;
+		}
+	}
+	if (hole != NULL)
+		close_hole(a, hole, bp);
+	return (moved);
+}
+
+/*
+ * Requires:
+ *   "hole" is the address of the start of free space that ends at the
+ *   allocated or epilogue block "bp", and the lock of arena "a" is held.
+ *
+ * Effects:
+ *   Makes the free space a free block of arena "a".
+ */
+static void
+close_hole(struct arena *a, char *hole, char *bp)
+{
+	size_t size = bp - hole;
+
+	PUT(HDRP(hole), PACK(size, PREV_ALLOC));
+	PUT(FTRP(hole), PACK(size, 0));
+	CLEAR_PREV_ALLOC(HDRP(bp));
+	add_to_front(a, hole);
+}
+
+/*
+ * Requires:
+ *   "size" is not zero.
+ *
+ * Effects:
+ *   Returns the index of the most significant bit set in "size".
+ */
+static inline int
+fls_size(size_t size)
+{
+
+	return ((int)(sizeof(long long) * 8) - 1 - __builtin_clzll(size));
+}
+
+/*
+ * Requires:
+ *   "asize" is a block size less than TREE_MIN bytes.
+ *
+ * Effects:
+ *   Stores the first- and second-level indices of the free list that holds
+ *   blocks of "asize" bytes in "*flp" and "*slp".
+ */
+static void
+mapping(size_t asize, int *flp, int *slp)
+{
+	int fl;
+
+	if (asize < SMALL_BLOCK) {
+		*flp = 0;
+		*slp = (int)(asize >> ASIZE_LOG2);
+	} else {
+		fl = fls_size(asize);
+		*slp = (int)(asize >> (fl - SL_SHIFT)) ^ SL_COUNT;
+		*flp = fl - FL_SHIFT + 1;
+	}
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block of arena "a" that is not in any
+ *   free list.
+ *
+ * Effects:
+ *   Makes "bp" arena "a"'s wilderness if it ends the arena's last region.
+ *   Otherwise, inserts "bp" at the front of the free list for its size
+ *   class and marks that list non-empty in the bitmaps, or inserts "bp"
+ *   into the tree if it is a large block.
+ */
+static void
+add_to_front(struct arena *a, void *bp)
+{
+	struct fnode *nodep = bp, *next;
+	int fl, sl;
+
+	if (NEXT_PHYS_BLKP(bp) == a->top) {
+		a->wild = bp;
+		return;
+	}
+	if (GET_SIZE(HDRP(bp)) >= TREE_MIN) {
+		tree_insert(&a->tree, bp);
+		return;
+	}
+	mapping(GET_SIZE(HDRP(bp)), &fl, &sl);
+	next = a->seg_heads[fl][sl];
+	nodep->next = (next != NULL) ? BLK_OFF(next) : 0;
+	nodep->previous = 0;
+	if (next != NULL)
+		next->previous = BLK_OFF(nodep);
+	a->seg_heads[fl][sl] = nodep;
+	a->fl_bitmap |= 1U << fl;
+	a->sl_bitmap[fl] |= 1U << sl;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of arena "a"'s wilderness, or of a free block in
+ *   arena "a"'s free list for its size class, or in arena "a"'s tree if it
+ *   is a large block.
+ *
+ * Effects:
+ *   Removes "bp" from its free list, clearing the list's bitmap bits if the
+ *   list becomes empty, or from the tree.  The wilderness is simply
+ *   forgotten.
+ */
+static void
+splice(struct arena *a, void *bp)
+{
+	struct fnode *nodep = bp;
+	int fl, sl;
+
+	if (bp == a->wild) {
+		a->wild = NULL;
+		return;
+	}
+	if (GET_SIZE(HDRP(bp)) >= TREE_MIN) {
+		tree_remove(&a->tree, bp);
+		return;
+	}
+	if (nodep->next != 0)
+		OFF_BLK(nodep->next)->previous = nodep->previous;
+	if (nodep->previous != 0) {
+		OFF_BLK(nodep->previous)->next = nodep->next;
+		return;
+	}
+
+	/* "bp" heads its list, so the list may become empty. */
+	mapping(GET_SIZE(HDRP(bp)), &fl, &sl);
+	a->seg_heads[fl][sl] = OFF_BLK(nodep->next);
+	if (nodep->next == 0) {
+		a->sl_bitmap[fl] &= ~(1U << sl);
+		if (a->sl_bitmap[fl] == 0)
+			a->fl_bitmap &= ~(1U << fl);
+	}
+}
+
+/*
+ * The following routines implement huge blocks, which are mappings.
+ */
+
+/*
+ * Requires:
+ *   "size" is not zero.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload in a mapping of
+ *   its own.  Returns the address of this block if the allocation was
+ *   successful and NULL otherwise.
+ */
+static void *
+huge_alloc(size_t size)
+{
+	size_t msize;
+	char *p;
+
+	msize = (size + HUGE_HDR + RUNSIZE - 1) & ~(size_t)(RUNSIZE - 1);
+	if (msize < size)
+		return (NULL);
+	pthread_mutex_lock(&sbrk_lock);
+	p = mem_map(msize);
+	pthread_mutex_unlock(&sbrk_lock);
+	if (p == (void *)-1)
+		return (NULL);
+	p += HUGE_HDR;
+	HUGE_SIZE(p) = msize;
+	return (p);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a huge block.
+ *
+ * Effects:
+ *   Free the huge block "bp" by unmapping it.
+ */
+static void
+huge_free(void *bp)
+{
+
+	pthread_mutex_lock(&sbrk_lock);
+	mem_unmap((char *)bp - HUGE_HDR);
+	pthread_mutex_unlock(&sbrk_lock);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a huge block, and "size" is not zero.
+ *
+ * Effects:
+ *   Resizes the mapping of the huge block "bp" to hold "size" bytes of
+ *   payload, moving it if necessary.  Returns the address of the resized
+ *   block if successful and NULL otherwise, in which case "bp" is left
+ *   untouched.
+ */
+static void *
+huge_realloc(void *bp, size_t size)
+{
+	size_t msize;
+	char *p;
+
+	msize = (size + HUGE_HDR + RUNSIZE - 1) & ~(size_t)(RUNSIZE - 1);
+	if (msize < size)
+		return (NULL);
+	if (msize == HUGE_SIZE(bp))
+		return (bp);
+	pthread_mutex_lock(&sbrk_lock);
+	p = mem_remap((char *)bp - HUGE_HDR, msize);
+	pthread_mutex_unlock(&sbrk_lock);
+	if (p == (void *)-1)
+		return (NULL);
+	p += HUGE_HDR;
+	HUGE_SIZE(p) = msize;
+	return (p);
+}
+
+/*
+ * The following routines implement the tree of large free blocks.
+ */
+
+/*
+ * Requires:
+ *   The lock of arena "a" is held.
+ *
+ * Effects:
+ *   Returns the smallest block in arena "a"'s tree of at least "asize"
+ *   bytes, preferring the lowest address among blocks of that size, or
+ *   NULL if there is none.
+ */
+static void *
+tree_fit(struct arena *a, size_t asize)
+{
+	struct tnode *n, *fit = NULL;
+
+	for (n = a->tree; n != NULL; ) {
+		if (n->size >= asize) {
+			fit = n;
+			n = n->left;
+		} else
+			n = n->right;
+	}
+	return (fit);
+}
+
+/*
+ * Requires:
+ *   "n" is a free block that is not in the tree rooted at "*rootp".
+ *
+ * Effects:
+ *   Inserts "n" into the tree rooted at "*rootp", caching its size, and
+ *   rebalances the tree.
+ */
+static void
+tree_insert(struct tnode **rootp, struct tnode *n)
+{
+	struct tnode **path[TREE_DEPTH], **linkp = rootp;
+	int depth = 0;
+
+	n->size = GET_SIZE(HDRP(n));
+	while (*linkp != NULL) {
+		path[depth++] = linkp;
+		linkp = tree_less(n, *linkp) ? &(*linkp)->left :
+		    &(*linkp)->right;
+	}
+	n->left = n->right = NULL;
+	n->height = 1;
+	*linkp = n;
+	tree_rebalance(path, depth);
+}
+
+/*
+ * Requires:
+ *   "n" is a free block in the tree rooted at "*rootp".
+ *
+ * Effects:
+ *   Removes "n" from the tree rooted at "*rootp" and rebalances the tree.
+ */
+static void
+tree_remove(struct tnode **rootp, struct tnode *n)
+{
+	struct tnode **path[TREE_DEPTH], **linkp = rootp, **minp, *min;
+	int depth = 0, top;
+
+	while (*linkp != n) {
+		path[depth++] = linkp;
+		linkp = tree_less(n, *linkp) ? &(*linkp)->left :
+		    &(*linkp)->right;
+	}
+	if (n->right == NULL) {
+		*linkp = n->left;
+		tree_rebalance(path, depth);
+		return;
+	}
+
+	/*
+	 * Replace "n" with the smallest node of its right subtree.  The link
+	 * to "n" stays on the path, and the path's next link, if any, moves
+	 * from "n" to its replacement.
+	 */
+	top = depth;
+	path[depth++] = linkp;
+	for (minp = &n->right; (*minp)->left != NULL; minp = &(*minp)->left)
+		path[depth++] = minp;
+	min = *minp;
+	*minp = min->right;
+	min->left = n->left;
+	min->right = n->right;
+	min->height = n->height;
+	*linkp = min;
+	if (depth > top + 1)
+		path[top + 1] = &min->right;
+	tree_rebalance(path, depth);
+}
+
+/*
+ * Requires:
+ *   "path" holds the "depth" links from the root of a tree down to the
+ *   parent of a node that was just inserted or removed.
+ *
+ * Effects:
+ *   Rebalances the subtrees on the path from the bottom up, stopping at
+ *   the first subtree whose height does not change.
+ */
+static void
+tree_rebalance(struct tnode **path[], int depth)
+{
+	struct tnode *n;
+	int height;
+
+	while (depth-- > 0) {
+		n = *path[depth];
+		height = n->height;
+		n = *path[depth] = tree_balance(n);
+		if (n->height == height)
+			break;
+	}
+}
+
+/*
+ * Requires:
+ *   "root" is not NULL, and the heights of its subtrees differ by at most
+ *   two.
+ *
+ * Effects:
+ *   Restores the AVL balance of the tree rooted at "root" with at most two
+ *   rotations, updates its height, and returns the new root.
+ */
+static struct tnode *
+tree_balance(struct tnode *root)
+{
+	int diff = tree_height(root->left) - tree_height(root->right);
+
+	if (diff > 1) {
+		if (tree_height(root->left->left) <
+		    tree_height(root->left->right))
+			root->left = tree_rotate(root->left, true);
+		return (tree_rotate(root, false));
+	}
+	if (diff < -1) {
+		if (tree_height(root->right->right) <
+		    tree_height(root->right->left))
+			root->right = tree_rotate(root->right, false);
+		return (tree_rotate(root, true));
+	}
+	root->height = MAX(tree_height(root->left),
+	    tree_height(root->right)) + 1;
+	return (root);
+}
+
+/*
+ * Requires:
+ *   "root" has a right child if "left" is true and a left child otherwise.
+ *
+ * Effects:
+ *   Rotates the tree rooted at "root" to the left if "left" is true and to
+ *   the right otherwise, and returns the new root.
+ */
+static struct tnode *
+tree_rotate(struct tnode *root, bool left)
+{
+	struct tnode *pivot;
+
+	if (left) {
+		pivot = root->right;
+		root->right = pivot->left;
+		pivot->left = root;
+	} else {
+		pivot = root->left;
+		root->left = pivot->right;
+		pivot->right = root;
+	}
+	root->height = MAX(tree_height(root->left),
+	    tree_height(root->right)) + 1;
+	pivot->height = MAX(tree_height(pivot->left),
+	    tree_height(pivot->right)) + 1;
+	return (pivot);
+}
+
+/*
+ * Requires:
+ *   "x" and "y" are free blocks.
+ *
+ * Effects:
+ *   Returns true if "x" orders before "y" by size and then by address.
+ */
+static inline bool
+tree_less(struct tnode *x, struct tnode *y)
+{
+
+	return (x->size < y->size || (x->size == y->size && x < y));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the height of the subtree rooted at "n", which is 0 if "n" is
+ *   NULL.
+ */
+static inline int
+tree_height(struct tnode *n)
+{
+
+	return ((n == NULL) ? 0 : n->height);
+}
+
+/*
+ * The following routines implement the small-object allocator.
+ */
+
+/*
+ * Requires:
+ *   "size" is between 1 and SLAB_MAX, and the lock of arena "a" is held.
+ *
+ * Effects:
+ *   Allocate a slot of at least "size" bytes from one of arena "a"'s runs
+ *   of the matching size class, creating a new run if the class has no
+ *   free slot.  Returns the address of the slot if the allocation was
+ *   successful and NULL otherwise.
+ */
+static void *
+slab_alloc(struct arena *a, size_t size)
+{
+	struct run *run;
+	uint32_t slot;
+	int cls = (int)((size - 1) / ASIZE);
+	int i;
+
+	if ((run = a->runs[cls]) == NULL &&
+	    (run = new_run(a, (uint32_t)(cls + 1) * ASIZE)) == NULL)
+		return (NULL);
+
+	/* A run on the list has a free slot, so this search succeeds. */
+	for (i = 0; ~run->used[i] == 0; i++)
+		continue;
+	slot = i * 64 + __builtin_ctzll(~run->used[i]);
+	run->used[i] |= (uint64_t)1 << (slot % 64);
+	if (--run->nfree == 0)
+		run_unlink(a, run);
+	return (RUN_SLOTP(run) + slot * run->size);
+}
+
+/*
+ * Requires:
+ *   "p" is the address of an allocated slot of arena "a", and the lock of
+ *   arena "a" is held.
+ *
+ * Effects:
+ *   Free the slot "p".  A run that becomes empty is returned to the heap
+ *   unless it is the last run with free slots in its size class.
+ */
+static void
+slab_free(struct arena *a, void *p)
+{
+	struct run *run = RUNP(p);
+	uint32_t slot = (uint32_t)((char *)p - RUN_SLOTP(run)) / run->size;
+
+	run->used[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+	if (run->nfree++ == 0)
+		run_link(a, run);
+	if (run->nfree == RUN_NSLOTS(run) &&
+	    (run->next != NULL || run->previous != NULL))
+		release_run(a, run);
+}
+
+/*
+ * Requires:
+ *   "size" is a multiple of ASIZE that is at most SLAB_MAX, and the lock of
+ *   arena "a" is held.
+ *
+ * Effects:
+ *   Allocate a page-aligned run of "size"-byte slots from arena "a" and put
+ *   it on the list of its size class.  Returns the run if successful and
+ *   NULL otherwise.
+ */
+static struct run *
+new_run(struct arena *a, uint32_t size)
+{
+	struct run *run;
+	char *bp;
+	uint32_t slot;
+
+	/* The run must start on a page boundary. */
+	if ((bp = alloc_aligned(a, RUNSIZE, RUNSIZE)) == NULL)
+		return (NULL);
+
+	/* Initialize the run and mark its page. */
+	run = (struct run *)bp;
+	run->size = size;
+	run->nfree = RUN_NSLOTS(run);
+	memset(run->used, 0, sizeof(run->used));
+	for (slot = run->nfree; slot < RUN_WORDS * 64; slot++)
+		run->used[slot / 64] |= (uint64_t)1 << (slot % 64);
+	PAGE_PUT(PAGE_NUM(run), PAGE_GET(PAGE_NUM(run)) | PAGE_RUN);
+	run->next = run->previous = NULL;
+	run_link(a, run);
+	return (run);
+}
+
+/*
+ * Requires:
+ *   "run" is an empty run in its size class's list in arena "a".
+ *
+ * Effects:
+ *   Removes "run" from its list and returns its block to arena "a".
+ */
+static void
+release_run(struct arena *a, struct run *run)
+{
+
+	run_unlink(a, run);
+	PAGE_PUT(PAGE_NUM(run), PAGE_GET(PAGE_NUM(run)) & ~PAGE_RUN);
+	free_block(a, run);
+}
+
+/*
+ * Requires:
+ *   The lock of arena "a" is held.
+ *
+ * Effects:
+ *   Releases every empty run of arena "a", including the one that
+ *   slab_free keeps for each size class.
+ */
+static void
+release_empty_runs(struct arena *a)
+{
+	struct run *run, *next;
+	int i;
+
+	for (i = 0; i < SLAB_CLASSES; i++) {
+		for (run = a->runs[i]; run != NULL; run = next) {
+			next = run->next;
+			if (run->nfree == RUN_NSLOTS(run))
+				release_run(a, run);
+		}
+	}
+}
+
+/*
+ * Requires:
+ *   "run" is not in its size class's list in arena "a".
+ *
+ * Effects:
+ *   Inserts "run" at the front of its size class's list in arena "a".
+ */
+static void
+run_link(struct arena *a, struct run *run)
+{
+	struct run **headp = &a->runs[run->size / ASIZE - 1];
+
+	run->next = *headp;
+	run->previous = NULL;
+	if (*headp != NULL)
+		(*headp)->previous = run;
+	*headp = run;
+}
+
+/*
+ * Requires:
+ *   "run" is in its size class's list in arena "a".
+ *
+ * Effects:
+ *   Removes "run" from its size class's list in arena "a".
+ */
+static void
+run_unlink(struct arena *a, struct run *run)
+{
+
+	if (run->next != NULL)
+		run->next->previous = run->previous;
+	if (run->previous != NULL)
+		run->previous->next = run->next;
+	else
+		a->runs[run->size / ASIZE - 1] = run->next;
+	run->next = run->previous = NULL;
+}
+
+/*
+ * The following routines implement the maintenance thread.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Runs a maintenance pass every maint_period milliseconds until
+ *   mm_maint_stop is called.
+ */
+static void *
+maint_main(void *arg)
+{
+	unsigned long seen[NARENAS_MAX];
+	struct timespec ts;
+
+	(void)arg;
+	memset(seen, 0, sizeof(seen));
+	pthread_mutex_lock(&maint_lock);
+	while (maint_running) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += maint_period / 1000;
+		ts.tv_nsec += (long)(maint_period % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		if (pthread_cond_timedwait(&maint_cond, &maint_lock, &ts) == 0)
+			continue;
+		pthread_mutex_unlock(&maint_lock);
+		maint_pass(seen);
+		pthread_mutex_lock(&maint_lock);
+	}
+	pthread_mutex_unlock(&maint_lock);
+	return (NULL);
+}
+
+/*
+ * Requires:
+ *   "seen" holds the allocation count of each arena at the last pass.
+ *
+ * Effects:
+ *   Performs the deferred work of every arena whose lock is free, without
+ *   waiting for any lock: completes its remote frees, coalesces its quick
+ *   lists if it has not allocated since the last pass, and trims the heap
+ *   if the arena ends it with a free block of at least the trim threshold.
+ */
+static void
+maint_pass(unsigned long *seen)
+{
+	struct arena *a;
+	void *bp;
+	int i;
+
+	for (i = 0; i < narenas; i++) {
+		a = &arenas[i];
+		if (pthread_mutex_trylock(&a->lock) != 0)
+			continue;
+		drain_remote(a);
+		if (a->nalloc == seen[i] && a->nquick != 0)
+			quick_flush(a);
+		seen[i] = a->nalloc;
+		if (a->top != NULL && !GET_PREV_ALLOC(HDRP(a->top))) {
+			bp = PREV_PHYS_BLKP(a->top);
+			if (GET_SIZE(HDRP(bp)) >= trim_threshold)
+				trim_top(a, MAX(TRIM_PAD, a->grow));
+		}
+		pthread_mutex_unlock(&a->lock);
+	}
+}
+
+/*
+ * The following routines implement the per-thread caches.
+ */
+
+/*
+ * Requires:
+ *   "size" is not zero.
+ *
+ * Effects:
+ *   Removes and returns a block or slot for a request of "size" bytes from
+ *   this thread's cache.  Returns NULL if the cache holds none.
+ */
+static void *
+tcache_get(size_t size)
+{
+	struct node *bp;
+	size_t key;
+
+	key = class_size(size);
+	if (key == 0 || key > TCACHE_MAX)
+		return (NULL);
+	if (tcache.gen != __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE))
+		return (NULL);
+	if ((bp = tcache.heads[key / ASIZE]) == NULL)
+		return (NULL);
+	tcache.heads[key / ASIZE] = bp->next;
+	tcache.counts[key / ASIZE]--;
+	tcache.bytes -= key;
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block or slot, and "key" is the
+ *   size of the slot or at most the size of the block.
+ *
+ * Effects:
+ *   Adds "bp" to this thread's cache under "key" and returns true, or
+ *   returns false if "key" is too large to cache, its list or the cache is
+ *   full, or "bp" is a block next to a free block, which should coalesce
+ *   instead.  Discards the cache's contents if they belong to an earlier
+ *   heap generation.
+ */
+static bool
+tcache_put(void *bp, size_t key)
+{
+	struct node *nodep = bp;
+	unsigned long gen;
+
+	if (key == 0 || key > TCACHE_MAX)
+		return (false);
+
+	/*
+	 * The arena may be changing the neighbors' headers and this block's
+	 * PREV_ALLOC bit, so a stale value only means that the block is
+	 * cached or freed needlessly.
+	 */
+	if (key > SLAB_MAX && (!GET_PREV_ALLOC(HDRP(bp)) ||
+	    !GET_ALLOC(HDRP(NEXT_PHYS_BLKP(bp)))))
+		return (false);
+	gen = __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE);
+	if (tcache.gen != gen) {
+		memset(tcache.heads, 0, sizeof(tcache.heads));
+		memset(tcache.counts, 0, sizeof(tcache.counts));
+		tcache.bytes = 0;
+		tcache.gen = gen;
+		if (!tcache.registered) {
+			pthread_once(&tcache_once, tcache_key_create);
+			pthread_setspecific(tcache_key, &tcache);
+			tcache.registered = true;
+		}
+	}
+	if (tcache.counts[key / ASIZE] >= TCACHE_COUNT ||
+	    tcache.bytes + key > TCACHE_BYTES)
+		return (false);
+	nodep->next = tcache.heads[key / ASIZE];
+	tcache.heads[key / ASIZE] = nodep;
+	tcache.counts[key / ASIZE]++;
+	tcache.bytes += key;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "arg" is the address of an exiting thread's cache.
+ *
+ * Effects:
+ *   Returns every block in the cache to the arena that owns it, unless the
+ *   heap has been reinitialized since the blocks were cached.
+ */
+static void
+tcache_flush(void *arg)
+{
+	struct tcache *tc = arg;
+	struct arena *a;
+	struct node *bp;
+	size_t i;
+
+	if (tc->gen != __atomic_load_n(&heap_gen, __ATOMIC_ACQUIRE))
+		return;
+	for (i = 0; i < TCACHE_MAX / ASIZE + 1; i++) {
+		while ((bp = tc->heads[i]) != NULL) {
+			tc->heads[i] = bp->next;
+			a = OWNER(bp);
+			pthread_mutex_lock(&a->lock);
+			free_locked(a, bp);
+			pthread_mutex_unlock(&a->lock);
+		}
+		tc->counts[i] = 0;
+	}
+	tc->bytes = 0;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Creates the key whose destructor flushes a thread's cache at exit.
+ */
+static void
+tcache_key_create(void)
+{
+
+	pthread_key_create(&tcache_key, tcache_flush);
+}
+
+/*
+ * The remaining routines are heap consistency checker routines.
+ */
+
+#ifdef MM_DEBUG
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block or slot in the heap.
+ *
+ * Effects:
+ *   Aborts with a message unless "bp" is the slot or block that a request
+ *   of "size" bytes would be given, a block that mm_memalign carved for
+ *   such a request, or a block that has since been shrunk in place for
+ *   such a request.
+ */
+static void
+checksized(void *bp, size_t size)
+{
+	bool ok;
+
+	if (IS_RUN(bp))
+		ok = size <= SLAB_MAX && RUNP(bp)->size == class_size(size);
+	else if (size <= SLAB_MAX) {
+		/* Only mm_memalign gives a slot-sized request a block. */
+		ok = GET_SIZE(HDRP(bp)) < class_size(SLAB_MAX + 1) + QSIZE;
+	} else
+		ok = class_size(size) != 0 &&
+		    class_size(size) <= GET_SIZE(HDRP(bp));
+	if (!ok) {
+		fprintf(stderr, "Error: size %zu does not match block %p\n",
+		    size, bp);
+		abort();
+	}
+}
+#endif
+
+/*
+ * Requires:
+ *   "bp" is the address of a block.
+ *
+ * Effects:
+ *   Perform a minimal check on the block "bp".
+ */
+static void
+checkblock(void *bp)
+{
+
+	if ((uintptr_t)bp % ASIZE)
+		printf("Error: %p is not word aligned\n", bp);
+	if (!GET_ALLOC(HDRP(bp)) &&
+	    GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp)))
+		printf("Error: header does not match footer\n");
+	if ((GET_ALLOC(HDRP(bp)) != 0) !=
+	    (GET_PREV_ALLOC(HDRP(NEXT_PHYS_BLKP(bp))) != 0))
+		printf("Error: %p's allocated bit is not recorded by the next "
+		    "block\n", bp);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Perform a minimal check of the heap for consistency.  Every region
+ *   must have a valid prologue and epilogue.  Every block in an arena's
+ *   free lists must be free, owned by that arena, and in the list of its
+ *   size class, every free block in the heap must be in some free list or
+ *   tree or be an arena's wilderness, and the bitmaps must mark exactly the
+ *   non-empty lists.  Every block on a quick list must be allocated and of
+ *   the list's size.  Every run with a free slot must be marked as a run
+ *   and have a free count that matches its bitmap.
+ */
+void
+checkheap(bool verbose)
 {
+	struct arena *a;
+	struct node *cur;
+	struct fnode *fcur;
+	struct region *region;
+	struct run *run;
 	void *bp;
+	size_t nfree = 0, nquick;
+	uint32_t nused;
+	int fl, sl, cfl, csl, cls, i;
 
-	if (verbose)
-		printf("Heap (%p):\n", heap_listp);
+	for (region = regions; region != NULL; region = region->next) {
+		bp = REGION_PROLOGUE(region);
+		if (verbose)
+			printf("Region (%p) of arena %d:\n", bp,
+			    (int)(OWNER(bp) - arenas));
+		if (GET_SIZE(HDRP(bp)) != DSIZE)
+			printf("Bad prologue header: size\n");
+		if (!GET_ALLOC(HDRP(bp)))
+			printf("Bad prologue header: alloc\n");
+		checkblock(bp);
 
-	if (GET_SIZE(HDRP(heap_listp)) != DSIZE)
-		printf("Bad prologue header: size\n");
-	if (!GET_ALLOC(HDRP(heap_listp)))
-		printf("Bad prologue header: alloc\n");
-	checkblock(heap_listp);
+		for (; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_PHYS_BLKP(bp)) {
+			if (verbose)
+				printblock(bp);
+			checkblock(bp);
+			if (OWNER(bp) != OWNER(region))
+				printf("Error: %p is not owned by its region's "
+				    "arena\n", bp);
+			if (!GET_ALLOC(HDRP(bp))) {
+				nfree++;
+				if (!GET_ALLOC(HDRP(NEXT_PHYS_BLKP(bp))))
+					printf("Error: %p was not coalesced\n",
+					    bp);
+			}
+		}
 
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
 		if (verbose)
 			printblock(bp);
-		checkblock(bp);
+		if (GET_SIZE(HDRP(bp)) != 0)
+			printf("Bad epilogue header: size\n");
+		if (!GET_ALLOC(HDRP(bp)))
+			printf("Bad epilogue header: alloc\n");
+		if (region->next == NULL && bp != OWNER(region)->top)
+			printf("Error: the last region is not its arena's "
+			    "top\n");
 	}
 
-	if (verbose)
-		printblock(bp);
-	if (GET_SIZE(HDRP(bp)) != 0)
-		printf("Bad epilogue header: size\n");
-	if (!GET_ALLOC(HDRP(bp)))
-		printf("Bad epilogue header: alloc\n");
+	for (a = arenas; a < arenas + narenas; a++) {
+		for (fl = 0; fl < FL_COUNT; fl++) {
+			if (((a->fl_bitmap >> fl) & 1) !=
+			    (a->sl_bitmap[fl] != 0))
+				printf("Error: first-level bitmap bit %d is "
+				    "wrong\n", fl);
+			for (sl = 0; sl < SL_COUNT; sl++) {
+				if (((a->sl_bitmap[fl] >> sl) & 1) !=
+				    (a->seg_heads[fl][sl] != NULL))
+					printf("Error: second-level bitmap bit "
+					    "%d/%d is wrong\n", fl, sl);
+				for (fcur = a->seg_heads[fl][sl]; fcur != NULL;
+				    fcur = OFF_BLK(fcur->next)) {
+					if (GET_ALLOC(HDRP(fcur)))
+						printf("Error: %p in free list "
+						    "is allocated\n",
+						    (void *)fcur);
+					if (OWNER(fcur) != a)
+						printf("Error: %p is in another"
+						    " arena's list\n",
+						    (void *)fcur);
+					mapping(GET_SIZE(HDRP(fcur)), &cfl,
+					    &csl);
+					if (cfl != fl || csl != sl)
+						printf("Error: %p is in the "
+						    "wrong list\n",
+						    (void *)fcur);
+					if (fcur->next != 0 &&
+					    OFF_BLK(fcur->next)->previous !=
+					    BLK_OFF(fcur))
+						printf("Error: %p has a bad "
+						    "next link\n",
+						    (void *)fcur);
+					nfree--;
+				}
+			}
+		}
+
+		nfree -= checktree(a, a->tree, NULL, NULL);
+
+		if (a->wild != NULL) {
+			if (GET_ALLOC(HDRP(a->wild)) || OWNER(a->wild) != a ||
+			    NEXT_PHYS_BLKP(a->wild) != a->top)
+				printf("Error: arena %d has a bad wilderness\n",
+				    (int)(a - arenas));
+			nfree--;
+		}
+
+		nquick = 0;
+		for (i = 0; i < QUICK_MAX / ASIZE + 1; i++) {
+			for (cur = a->quick[i]; cur != NULL; cur = cur->next) {
+				if (!GET_ALLOC(HDRP(cur)) || OWNER(cur) != a ||
+				    GET_SIZE(HDRP(cur)) != (size_t)i * ASIZE)
+					printf("Error: %p is on the wrong "
+					    "quick list\n", (void *)cur);
+				nquick++;
+			}
+		}
+		if (nquick != a->nquick)
+			printf("Error: arena %d has a bad quick list count\n",
+			    (int)(a - arenas));
+
+		for (cls = 0; cls < SLAB_CLASSES; cls++) {
+			for (run = a->runs[cls]; run != NULL; run = run->next) {
+				if (!IS_RUN(run) || OWNER(run) != a ||
+				    GET_SIZE(HDRP(run)) != RUNSIZE)
+					printf("Error: run %p is not marked\n",
+					    (void *)run);
+				if (run->size != (uint32_t)(cls + 1) * ASIZE)
+					printf("Error: run %p is in the wrong "
+					    "class\n", (void *)run);
+				nused = 0;
+				for (i = 0; i < RUN_WORDS; i++)
+					nused += __builtin_popcountll(
+					    run->used[i]);
+				if (run->nfree == 0 ||
+				    run->nfree != RUN_WORDS * 64 - nused)
+					printf("Error: run %p has a bad free "
+					    "count\n", (void *)run);
+			}
+		}
+	}
+	if (nfree != 0)
+		printf("Error: free lists do not match the heap\n");
+}
+
+/*
+ * Requires:
+ *   "n" is NULL or a node in arena "a"'s tree, and "lo" and "hi" are NULL
+ *   or nodes in the same tree.
+ *
+ * Effects:
+ *   Checks that every node in the subtree rooted at "n" is a large free
+ *   block owned by arena "a" that orders after "lo" and before "hi", and
+ *   that the subtree is balanced with correct heights.  Returns the number
+ *   of nodes in the subtree.
+ */
+static size_t
+checktree(struct arena *a, struct tnode *n, struct tnode *lo,
+    struct tnode *hi)
+{
+	int lh, rh;
+
+	if (n == NULL)
+		return (0);
+	if (GET_ALLOC(HDRP(n)) || OWNER(n) != a)
+		printf("Error: %p in the tree is not a free block of its "
+		    "arena\n", (void *)n);
+	if (GET_SIZE(HDRP(n)) < TREE_MIN)
+		printf("Error: %p is too small for the tree\n", (void *)n);
+	if (n->size != GET_SIZE(HDRP(n)))
+		printf("Error: %p has a stale size in the tree\n", (void *)n);
+	if ((lo != NULL && !tree_less(lo, n)) ||
+	    (hi != NULL && !tree_less(n, hi)))
+		printf("Error: %p is out of order in the tree\n", (void *)n);
+	lh = tree_height(n->left);
+	rh = tree_height(n->right);
+	if (n->height != MAX(lh, rh) + 1 || lh - rh > 1 || rh - lh > 1)
+		printf("Error: %p is unbalanced in the tree\n", (void *)n);
+	return (checktree(a, n->left, lo, n) + checktree(a, n->right, n, hi) +
+	    1);
 }
 
 /*
@@ -656,25 +3857,25 @@ checkheap(bool verbose)
  *   Print the block "bp".
  */
 static void
-printblock(void *bp) 
+printblock(void *bp)
 {
-	size_t hsize, fsize;
-	bool halloc, falloc;
+	size_t hsize;
+	bool halloc, prev_alloc;
 
-	checkheap(false);
 	hsize = GET_SIZE(HDRP(bp));
-	halloc = GET_ALLOC(HDRP(bp));  
-	fsize = GET_SIZE(FTRP(bp));
-	falloc = GET_ALLOC(FTRP(bp));  
-
+	halloc = GET_ALLOC(HDRP(bp));
+	prev_alloc = GET_PREV_ALLOC(HDRP(bp));
 	if (hsize == 0) {
 		printf("%p: end of heap\n", bp);
 		return;
 	}
 
-	printf("%p: header: [%zu:%c] footer: [%zu:%c]\n", bp, 
-	    hsize, (halloc ? 'a' : 'f'), 
-	    fsize, (falloc ? 'a' : 'f'));
+	if (halloc)
+		printf("%p: header: [%zu:a:%c]\n", bp, hsize,
+		    (prev_alloc ? 'a' : 'f'));
+	else
+		printf("%p: header: [%zu:f:%c] footer: [%zu]\n", bp, hsize,
+		    (prev_alloc ? 'a' : 'f'), GET_SIZE(FTRP(bp)));
 }
 
 /*
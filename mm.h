@@ -7,6 +7,48 @@ int mm_init(void);
 void *mm_malloc(size_t size);
 void mm_free(void *ptr);
 void *mm_realloc(void *ptr, size_t size);
+void mm_free_sized(void *ptr, size_t size);
+void *mm_realloc_sized(void *ptr, size_t oldsize, size_t size);
+void *mm_calloc(size_t nmemb, size_t size);
+size_t mm_malloc_batch(size_t size, size_t n, void **out);
+void mm_free_batch(void **ptrs, size_t n);
+void *mm_memalign(size_t alignment, size_t size);
+void *mm_aligned_alloc(size_t alignment, size_t size);
+int mm_trim(size_t pad);
+int mm_mallopt(int param, size_t value);
+int mm_maint_start(unsigned int period_ms);
+void mm_maint_stop(void);
+
+/* Bump arenas, whose allocations are all freed at once. */
+struct mm_arena;
+struct mm_arena *mm_arena_create(size_t chunk_size);
+void *mm_arena_alloc(struct mm_arena *ar, size_t size);
+void mm_arena_reset(struct mm_arena *ar);
+void mm_arena_destroy(struct mm_arena *ar);
+
+/* Pools of fixed-size objects. */
+struct mm_pool;
+struct mm_pool *mm_pool_create(size_t obj_size, size_t alignment);
+void *mm_pool_alloc(struct mm_pool *pool);
+void mm_pool_free(struct mm_pool *pool, void *p);
+void mm_pool_destroy(struct mm_pool *pool);
+
+/* Relocatable blocks, reached through handles. */
+struct mm_handle;
+struct mm_handle *mm_halloc(size_t size);
+void mm_hfree(struct mm_handle *h);
+void *mm_hlock(struct mm_handle *h);
+void mm_hunlock(struct mm_handle *h);
+size_t mm_compact(void);
+
+/* Parameters for mm_mallopt. */
+#define MM_TRIM_THRESHOLD 1  /* Free tail size that makes mm_free trim */
+#define MM_MMAP_THRESHOLD 2  /* Smallest request given its own mapping */
+#define MM_GROW_POLICY    3  /* How the heap is extended (see below) */
+
+/* Values of MM_GROW_POLICY. */
+#define MM_GROW_FIXED     0  /* Extend by the request or one chunk */
+#define MM_GROW_ADAPTIVE  1  /* Scale extensions with the rate of growth */
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, personal